@@ -0,0 +1,327 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "ans_internal.h"
+#include "symbol_stats_internal.h"
+
+#include "debug.h"
+#include "exitcodes.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static long* ans_allocate(long const count, char const *const what) {
+	long *const ret = calloc(count, sizeof(long));
+	if (!ret) {
+		fprintf(stderr, FL "Can't allocate ANS %s (%ld times %zu bytes)\n", what, count, sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	return ret;
+}
+
+/*
+ * Scale counts to add up to the table size, keeping every present symbol
+ * at 1 or more. Rounding errors are absorbed by the most frequent symbols.
+ */
+static void ans_normalize(anstable *const that, long const *const counts, long const total) {
+	long const table_size = 1L << that -> table_log;
+	long sum = 0;
+	long largest = 0;
+	for (long i = 0; i < that -> range; i++) {
+		if (counts[i]) {
+			long frequency = (counts[i] * table_size + total / 2) / total;
+			if (frequency < 1) {
+				frequency = 1;
+			}
+			that -> frequencies[i] = frequency;
+			sum += frequency;
+			if (frequency > that -> frequencies[largest]) {
+				largest = i;
+			}
+		}
+	}
+	if (sum < table_size) {
+		that -> frequencies[largest] += table_size - sum;
+	}
+	while (sum > table_size) {
+		largest = 0;
+		for (long i = 1; i < that -> range; i++) {
+			if (that -> frequencies[i] > that -> frequencies[largest]) {
+				largest = i;
+			}
+		}
+		that -> frequencies[largest]--;
+		sum--;
+	}
+}
+
+/*
+ * Table header: table size as a power of 2 in 4 bits, then the frequency
+ * of each value in the range, in just enough bits for what's left of the
+ * table. Values after the table is full aren't stored.
+ */
+static void ans_write_table(anstable const *const that, bitstream *const stream) {
+	bitstream_write_value(stream, that -> table_log, 4);
+	long remaining = 1L << that -> table_log;
+	for (long i = 0; i < that -> range && remaining > 0; i++) {
+		bitstream_write_value(stream, that -> frequencies[i], bitstream_bit_length(remaining));
+		remaining -= that -> frequencies[i];
+	}
+}
+
+static void ans_read_table(anstable *const that, bitstream *const stream) {
+	that -> table_log = bitstream_read_value(stream, 4);
+	if (that -> table_log < ANS_MIN_TABLE_LOG || that -> table_log > ANS_MAX_TABLE_LOG) {
+		fprintf(stderr, "Invalid ANS table size\n");
+		exit(EXIT_BADFILE);
+	}
+	that -> frequencies = ans_allocate(that -> range, "frequencies");
+	long remaining = 1L << that -> table_log;
+	for (long i = 0; i < that -> range && remaining > 0; i++) {
+		long const frequency = bitstream_read_value(stream, bitstream_bit_length(remaining));
+		if (frequency < 0 || frequency > remaining) {
+			fprintf(stderr, "Invalid ANS frequency\n");
+			exit(EXIT_BADFILE);
+		}
+		that -> frequencies[i] = frequency;
+		remaining -= frequency;
+	}
+	if (remaining) {
+		fprintf(stderr, "Invalid ANS table: frequencies don't fill the table\n");
+		exit(EXIT_BADFILE);
+	}
+}
+
+/*
+ * Spread the symbols over the table with a stride that's coprime with the
+ * table size, such that each symbol's states are scattered. The encoder
+ * and the decoder number the states of each symbol in table order.
+ */
+static void ans_spread(anstable const *const that, long *const spread) {
+	long const table_size = 1L << that -> table_log;
+	long const step = (table_size >> 1) + (table_size >> 3) + 3;
+	long position = 0;
+	for (long i = 0; i < that -> range; i++) {
+		for (long j = 0; j < that -> frequencies[i]; j++) {
+			spread[position] = i;
+			position = (position + step) & (table_size - 1);
+		}
+	}
+}
+
+/*
+ * Symbols are encoded backwards, such that the decoder gets them forwards.
+ * Even and odd symbols use separate states, so that decoding one doesn't
+ * wait on the other. The bits of each step are kept and written out in
+ * reverse at the end, after the final states.
+ *
+ * The range and counts come from stats, computed here when NULL.
+ *
+ * Stream: symbol range and zigzag symbol offset + 1 in Elias gamma, the
+ * table, the final states, then the bits of each symbol.
+ */
+void ans_encode(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			bitstream *const stream) {
+	if (count < 1) {
+		fprintf(stderr, FL "Encoding ANS without symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	symbol_stats* computed = NULL;
+	symbol_stats const* st = stats;
+	if (!st) {
+		computed = symbol_stats_construct();
+		symbol_stats_compute(computed, symbols, count);
+		st = computed;
+	}
+	if (!st -> counts || st -> symbol_count != count) {
+		fprintf(stderr, FL "Encoding ANS with statistics of other symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	anstable table;
+	table.symbol_min = st -> symbol_min;
+	if ((unsigned long)st -> symbol_max - (unsigned long)table.symbol_min >= ANS_MAX_RANGE) {
+		fprintf(stderr, FL "ANS symbol range too wide (%ld-%ld)\n", table.symbol_min, st -> symbol_max);
+		exit(EXIT_INVALIDSTATE);
+	}
+	table.range = st -> symbol_max - table.symbol_min + 1;
+	long *const counts = ans_allocate(table.range, "counts");
+	for (long slot = 0; slot < st -> slots; slot++) {
+		long const value = st -> values ? st -> values[slot] : slot + st -> symbol_min;
+		counts[value - table.symbol_min] = st -> counts[slot];
+	}
+	long const distinct = st -> distinct;
+	symbol_stats_destruct(computed);
+
+	// Small inputs don't need large tables, but every symbol needs 2 slots
+	table.table_log = bitstream_bit_length(count);
+	if (table.table_log > ANS_DEFAULT_TABLE_LOG) {
+		table.table_log = ANS_DEFAULT_TABLE_LOG;
+	}
+	if (table.table_log < bitstream_bit_length(distinct) + 1) {
+		table.table_log = bitstream_bit_length(distinct) + 1;
+	}
+	if (table.table_log < ANS_MIN_TABLE_LOG) {
+		table.table_log = ANS_MIN_TABLE_LOG;
+	}
+	long const table_size = 1L << table.table_log;
+	table.frequencies = ans_allocate(table.range, "frequencies");
+	ans_normalize(&table, counts, count);
+	free(counts);
+
+	long *const spread = ans_allocate(table_size, "spread table");
+	long *const states = ans_allocate(table_size, "encoding states");
+	ansencode *const encode = malloc(table.range * sizeof(ansencode));
+	if (!encode) {
+		fprintf(stderr, FL "Can't allocate ANS encoding table (%ld times %zu bytes)\n",
+					table.range,
+					sizeof(ansencode));
+		exit(EXIT_MEMORY);
+	}
+	ans_spread(&table, spread);
+	long first = 0;
+	for (long i = 0; i < table.range; i++) {
+		encode[i].frequency = table.frequencies[i];
+		encode[i].first = first;
+		encode[i].bits = table.table_log - bitstream_bit_length(table.frequencies[i]) + 1;
+		first += table.frequencies[i];
+	}
+	long *const next = ans_allocate(table.range, "state numbering");
+	for (long i = 0; i < table_size; i++) {
+		long const s = spread[i];
+		states[encode[s].first + next[s]++] = table_size + i;
+	}
+	free(next);
+	free(spread);
+
+	unsigned long *const values = malloc(count * sizeof(unsigned long));
+	unsigned char *const lengths = malloc(count);
+	if (!values || !lengths) {
+		fprintf(stderr, FL "Can't allocate ANS output (%ld symbols)\n", count);
+		exit(EXIT_MEMORY);
+	}
+	long state[ANS_STATES];
+	for (int j = 0; j < ANS_STATES; j++) {
+		state[j] = table_size;
+	}
+	for (long i = count - 1; i >= 0; i--) {
+		ansencode const *const e = encode + symbols[i] - table.symbol_min;
+		long const x = state[i % ANS_STATES];
+		int const bits = (x >> e -> bits) >= e -> frequency ? e -> bits : e -> bits - 1;
+		values[i] = x & ((1L << bits) - 1);
+		lengths[i] = bits;
+		state[i % ANS_STATES] = states[e -> first + (x >> bits) - e -> frequency];
+	}
+
+	bitstream_write_gamma(stream, table.range);
+	bitstream_write_gamma(stream, bitstream_zigzag(table.symbol_min) + 1);
+	ans_write_table(&table, stream);
+	for (int j = 0; j < ANS_STATES; j++) {
+		bitstream_write_value(stream, state[j] - table_size, table.table_log);
+	}
+	unsigned long accumulator = 0;
+	int pending = 0;
+	for (long i = 0; i < count; i++) {
+		if (pending + lengths[i] > bitstream_max_word_bits) {
+			bitstream_write_value(stream, accumulator, pending);
+			accumulator = 0;
+			pending = 0;
+		}
+		accumulator = (accumulator << lengths[i]) | values[i];
+		pending += lengths[i];
+	}
+	if (pending) {
+		bitstream_write_value(stream, accumulator, pending);
+	}
+	if (verbosity >= VERB_EXTRA) {
+		printf("ANS table of %ld states for %ld symbols\n", table_size, distinct);
+	}
+
+	free(values);
+	free(lengths);
+	free(states);
+	free(encode);
+	free(table.frequencies);
+}
+
+void ans_decode(bitstream *const stream,
+			long *const symbols,
+			long const count) {
+	anstable table;
+	table.range = bitstream_read_gamma(stream);
+	long const offset = bitstream_read_gamma(stream);
+	if (table.range < 1 || table.range > ANS_MAX_RANGE || offset < 1) {
+		fprintf(stderr, "Invalid ANS header\n");
+		exit(EXIT_BADFILE);
+	}
+	table.symbol_min = bitstream_unzigzag(offset - 1);
+	ans_read_table(&table, stream);
+	long const table_size = 1L << table.table_log;
+
+	long *const spread = ans_allocate(table_size, "spread table");
+	long *const next = ans_allocate(table.range, "state numbering");
+	ansdecode *const decode = malloc(table_size * sizeof(ansdecode));
+	if (!decode) {
+		fprintf(stderr, FL "Can't allocate ANS decoding table (%ld times %zu bytes)\n",
+					table_size,
+					sizeof(ansdecode));
+		exit(EXIT_MEMORY);
+	}
+	ans_spread(&table, spread);
+	memcpy(next, table.frequencies, table.range * sizeof(long));
+	for (long i = 0; i < table_size; i++) {
+		long const s = spread[i];
+		long const x = next[s]++;
+		decode[i].symbol = s + table.symbol_min;
+		decode[i].bits = table.table_log - bitstream_bit_length(x) + 1;
+		decode[i].base = (x << decode[i].bits) - table_size;
+	}
+	free(spread);
+	free(next);
+
+	long state[ANS_STATES];
+	for (int j = 0; j < ANS_STATES; j++) {
+		state[j] = bitstream_read_value(stream, table.table_log);
+		if (state[j] < 0) {
+			fprintf(stderr, "ANS stream ends in its header\n");
+			exit(EXIT_BADFILE);
+		}
+	}
+	for (long i = 0; i < count; i++) {
+		ansdecode const *const d = decode + state[i % ANS_STATES];
+		long const bits = bitstream_read_value(stream, d -> bits);
+		if (bits < 0) {
+			fprintf(stderr, "ANS stream ends in the middle of a symbol\n");
+			exit(EXIT_BADFILE);
+		}
+		symbols[i] = d -> symbol;
+		state[i % ANS_STATES] = d -> base + bits;
+	}
+	for (int j = 0; j < ANS_STATES; j++) {
+		if (state[j] != 0) {
+			fprintf(stderr, "Invalid ANS stream: final state %ld\n", state[j]);
+			exit(EXIT_BADFILE);
+		}
+	}
+	free(decode);
+	free(table.frequencies);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+/*
+ * Definitions for a table-based asymmetric numeral system (tANS) coder
+ */
+
+#ifndef ANS_H_INCLUDED
+#define ANS_H_INCLUDED
+
+#include "bitstream.h"
+#include "symbol_stats.h"
+
+/* Encode count symbols, with their statistics if already computed, NULL otherwise */
+void ans_encode(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			bitstream *const stream);
+
+/* Decode count symbols written by ans_encode */
+void ans_decode(bitstream *const stream,
+			long *const symbols,
+			long const count);
+
+#endif /* ANS_H_INCLUDED */
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef ANS_INTERNAL_H_INCLUDED
+#define ANS_INTERNAL_H_INCLUDED
+
+#include "ans.h"
+
+/* Table size, as a power of 2, when there are enough symbols */
+#define ANS_DEFAULT_TABLE_LOG 11
+
+/* Smallest table size, as a power of 2, for which the spreading stride works */
+#define ANS_MIN_TABLE_LOG 5
+
+/* Largest table size, as a power of 2, stored in 4 bits */
+#define ANS_MAX_TABLE_LOG 14
+
+/* Widest symbol range, tables are dense */
+#define ANS_MAX_RANGE 4096
+
+/* Number of interleaved states */
+#define ANS_STATES 2
+
+/* Normalized frequencies of a symbol range, adding up to 1 << table_log */
+typedef struct anstable {
+	long symbol_min;
+	long range;
+	int table_log;
+	long* frequencies;
+} anstable;
+
+/* Decoding table entry, the next state is base + the bits read */
+typedef struct ansdecode {
+	long symbol;
+	long base;
+	int bits;
+} ansdecode;
+
+/* Encoding data for a symbol */
+typedef struct ansencode {
+	long frequency;
+	long first;
+	int bits;
+} ansencode;
+
+#endif /* ANS_INTERNAL_H_INCLUDED */
@@ -23,11 +23,163 @@
 #include "exitcodes.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 const size_t bitstream_increment = 10240;
 
+long bitstream_allocation_count = 0;
+
+/*
+ * The fast paths move bits through a 64-bit accumulator that is loaded
+ * from and stored to the byte array 8 bytes at a time, MSB-first.
+ * A value can start at any of the 8 bit positions within the first
+ * byte, which leaves room for 57 bits in a single accumulator.
+ */
+_Static_assert(CHAR_BIT == 8, "word access requires 8-bit bytes");
+
+const int bitstream_word_bytes = 8;
+const int bitstream_max_word_bits = 57;
+
+static inline uint64_t bitstream_load_word(unsigned char const *const bytes) {
+	uint64_t word;
+	memcpy(&word, bytes, sizeof word);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	return word;
+}
+
+static inline void bitstream_store_word(unsigned char *const bytes, uint64_t word) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	word = __builtin_bswap64(word);
+#endif
+	memcpy(bytes, &word, sizeof word);
+}
+
+/* Load a word that might extend past the end of the array, zero-padded */
+static uint64_t bitstream_load_tail(bitstream const *const that, size_t const byte_offset) {
+	uint64_t word = 0;
+	for (size_t i = byte_offset; i < byte_offset + 8; i++) {
+		word <<= 8;
+		if (i < that -> allocated) {
+			word |= that -> array[i];
+		}
+	}
+	return word;
+}
+
+/*
+ * Load the next bits as a word, zero-padded past the end of the stream.
+ * Only the top 57 bits are guaranteed to be loaded.
+ */
+static inline uint64_t bitstream_lookahead(bitstream const *const that) {
+	if (that -> current >= that -> size) {
+		return 0;
+	}
+	size_t const byte_offset = that -> current / CHAR_BIT - that -> flushed;
+	uint64_t word;
+	if (byte_offset + bitstream_word_bytes <= that -> allocated) {
+		word = bitstream_load_word(that -> array + byte_offset);
+	} else {
+		word = bitstream_load_tail(that, byte_offset);
+	}
+	word <<= that -> current % CHAR_BIT;
+	if (that -> size - that -> current < 64) {
+		word &= ~UINT64_C(0) << (64 - (that -> size - that -> current));
+	}
+	return word;
+}
+
+int bitstream_bit_length(uint64_t const value) {
+	return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+size_t bitstream_truncated_bits(long const value, long const range) {
+	int const k = bitstream_bit_length(range) - 1;
+	return value < (1L << (k + 1)) - range ? k : k + 1;
+}
+
+size_t bitstream_gamma_bits(long const value) {
+	return 2 * bitstream_bit_length(value) - 1;
+}
+
+long bitstream_zigzag(long const value) {
+	return value >= 0 ? value * 2 : -value * 2 - 1;
+}
+
+long bitstream_unzigzag(long const value) {
+	return (value & 1) ? -(value >> 1) - 1 : value >> 1;
+}
+
+/* Resize the storage array to exactly numbytes bytes, zero-filling new storage */
+static void bitstream_resize(bitstream *const that, size_t const numbytes) {
+	if (that -> mapped) {
+		// A mapped file can't be realloc'd, move it to the heap first
+		unsigned char *const copy = malloc(numbytes);
+		if (!copy) {
+			fprintf(stderr, FL "Can't grow bitstream storage array (%zu bytes)\n", numbytes);
+			exit(EXIT_MEMORY);
+		}
+		memcpy(copy, that -> array, that -> allocated);
+		munmap(that -> array, that -> allocated);
+		that -> array = copy;
+		that -> mapped = 0;
+	}
+	that -> array = realloc(that -> array, numbytes);
+	bitstream_allocation_count++;
+	if (!that -> array) {
+		fprintf(stderr, FL "Can't grow bitstream storage array (%zu bytes)\n", numbytes);
+		exit(EXIT_MEMORY);
+	}
+	memset(that -> array + that -> allocated, 0, numbytes - that -> allocated);
+	that -> allocated = numbytes;
+}
+
+/* Write out all the complete bytes before the current position to the sink */
+static void bitstream_flush_sink(bitstream *const that) {
+	size_t const complete = that -> current / CHAR_BIT - that -> flushed;
+	if (fwrite(that -> array, 1, complete, that -> sink) < complete) {
+		fprintf(stderr, FL "Can't write bitstream to output file\n");
+		exit(EXIT_OUTPUTFILE);
+	}
+	memmove(that -> array, that -> array + complete, that -> allocated - complete);
+	memset(that -> array + that -> allocated - complete, 0, complete);
+	that -> flushed += complete;
+}
+
+/*
+ * Make sure that storage extends at least up to byte endbyte of the
+ * stream. Storage grows geometrically so that the total amount of
+ * copying stays linear in the final size. Sinks write out what they
+ * have instead of growing.
+ */
+static inline void bitstream_grow(bitstream *const that, size_t const endbyte) {
+	if (endbyte - that -> flushed <= that -> allocated) {
+		return;
+	}
+	if (that -> sink) {
+		bitstream_flush_sink(that);
+		if (endbyte - that -> flushed <= that -> allocated) {
+			return;
+		}
+	}
+	size_t const numbytes = endbyte - that -> flushed;
+	size_t newsize = that -> allocated * 2;
+	if (newsize < bitstream_increment) {
+		newsize = bitstream_increment;
+	}
+	if (newsize < numbytes) {
+		newsize = numbytes;
+	}
+	bitstream_resize(that, newsize);
+}
+
 bitstream* bitstream_construct() {
 	bitstream* that = (bitstream*) malloc(sizeof (bitstream));
 	if (!that) {
@@ -39,43 +191,105 @@ bitstream* bitstream_construct() {
 
 	that -> array = NULL;
 	that -> allocated = 0;
+	that -> mapped = 0;
+
+	that -> sink = NULL;
+	that -> owns_sink = 0;
+	that -> sink_origin = -1;
+	that -> flushed = 0;
 	return that;
 }
 
-bitstream* bitstream_construct_from_file(char const *const filename) {
-	bitstream* that = (bitstream*) malloc(sizeof (bitstream));
-	if (!that) {
-		fprintf(stderr, FL "Can't allocate bitstream structure (%zu bytes)\n", sizeof (bitstream));
-		exit(EXIT_MEMORY);
+bitstream* bitstream_construct_sink(FILE *const file) {
+	bitstream* that = bitstream_construct();
+	that -> sink = file;
+	that -> sink_origin = ftell(file);
+	bitstream_resize(that, bitstream_increment + bitstream_word_bytes);
+	return that;
+}
+
+bitstream* bitstream_construct_to_file(char const *const filename) {
+	FILE *const outputfile = fopen(filename, "w+b");
+	if (!outputfile) {
+		fprintf(stderr, FL "Can't open file %s\n", filename);
+		exit(EXIT_OUTPUTFILE);
 	}
+	bitstream* that = bitstream_construct_sink(outputfile);
+	that -> owns_sink = 1;
+	return that;
+}
+
+bitstream* bitstream_construct_from_file(char const *const filename) {
+	bitstream* that = bitstream_construct();
 
 	FILE* inputfile = fopen(filename, "rb");
-	fseek(inputfile, 0, SEEK_END);
-	long filesize = ftell(inputfile);
-	fseek(inputfile, 0, SEEK_SET);
+	if (!inputfile) {
+		fprintf(stderr, FL "Can't open file %s\n", filename);
+		exit(EXIT_INPUTFILE);
+	}
 
-	that -> array = malloc(filesize);
-	that -> allocated = filesize;
-	if (fread(that -> array, 1, filesize, inputfile) < (size_t)filesize) {
+	// Regular files are mapped directly, copy-on-write in case the stream gets written to
+	struct stat filestat;
+	if (fstat(fileno(inputfile), &filestat) == 0 && S_ISREG(filestat.st_mode) && filestat.st_size > 0) {
+		void *const map = mmap(NULL, filestat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(inputfile), 0);
+		if (map != MAP_FAILED) {
+			madvise(map, filestat.st_size, MADV_SEQUENTIAL);
+			that -> array = map;
+			that -> allocated = filestat.st_size;
+			that -> mapped = 1;
+			that -> size = that -> allocated * CHAR_BIT;
+			fclose(inputfile);
+			return that;
+		}
+	}
+
+	// Everything else (pipes, or when mapping fails) is read until end of file
+	size_t filesize = 0;
+	do {
+		bitstream_grow(that, filesize + bitstream_increment);
+		filesize += fread(that -> array + filesize, 1, that -> allocated - filesize, inputfile);
+	} while (filesize == that -> allocated);
+	if (ferror(inputfile)) {
 		fprintf(stderr, FL "Can't read file %s\n", filename);
-		exit (EXIT_INPUTFILE);
+		exit(EXIT_INPUTFILE);
 	}
 
 	that -> size = filesize * CHAR_BIT;
-	that -> current = 0;
-
 	fclose(inputfile);
 	return that;
 }
 
-
 void bitstream_destruct(bitstream *const that) {
-	if (that -> array) {
+	if (that -> sink) {
+		size_t const remaining = bitstream_byte_size(that) - that -> flushed;
+		if (fwrite(that -> array, 1, remaining, that -> sink) < remaining || fflush(that -> sink)) {
+			fprintf(stderr, FL "Can't write bitstream to output file\n");
+			exit(EXIT_OUTPUTFILE);
+		}
+		if (that -> owns_sink && fclose(that -> sink)) {
+			fprintf(stderr, FL "Can't close output file\n");
+			exit(EXIT_OUTPUTFILE);
+		}
+	}
+	if (that -> mapped) {
+		munmap(that -> array, that -> allocated);
+	} else if (that -> array) {
 		free(that -> array);
 	}
 	free(that);
 }
 
+void bitstream_reserve(bitstream *const that, size_t const numbits) {
+	if (that -> sink) {
+		// Sinks keep their memory bounded, they flush instead of growing
+		return;
+	}
+	size_t const numbytes = (that -> current + numbits + CHAR_BIT - 1) / CHAR_BIT + bitstream_word_bytes;
+	if (numbytes > that -> allocated) {
+		bitstream_resize(that, numbytes);
+	}
+}
+
 size_t bitstream_bit_size(bitstream *const that) {
 	return that -> size;
 }
@@ -92,13 +306,29 @@ int bitstream_read_bit(bitstream *const that) {
 	if (that -> current == that -> size) {
 		return -1;
 	}
-	size_t byte_offset = that -> current / CHAR_BIT;
+	size_t byte_offset = that -> current / CHAR_BIT - that -> flushed;
 	int ret = (that -> array[byte_offset] & (1U << (CHAR_BIT - 1 - that -> current % CHAR_BIT))) != 0;
 	that -> current++;
 	return ret;
 }
 
 long bitstream_read_value(bitstream *const that, int numbits) {
+	if (numbits <= 0) {
+		return 0;
+	}
+	if (numbits <= bitstream_max_word_bits && that -> current + numbits <= that -> size) {
+		size_t const byte_offset = that -> current / CHAR_BIT - that -> flushed;
+		uint64_t word;
+		if (byte_offset + bitstream_word_bytes <= that -> allocated) {
+			word = bitstream_load_word(that -> array + byte_offset);
+		} else {
+			word = bitstream_load_tail(that, byte_offset);
+		}
+		word <<= that -> current % CHAR_BIT;
+		that -> current += numbits;
+		return (long)(word >> (64 - numbits));
+	}
+
 	long ret = 0;
 	for (int i = 0; i < numbits; i++) {
 		int bit = bitstream_read_bit(that);
@@ -111,19 +341,28 @@ long bitstream_read_value(bitstream *const that, int numbits) {
 	return ret;
 }
 
-void bitstream_write_bit(bitstream *const that, int bit) {
-	if (that -> current + 1 > that -> size) {
-		that -> size++;
-		if (that -> size > that -> allocated * CHAR_BIT) {
-			that -> allocated += bitstream_increment;
-			that -> array = realloc(that -> array, that -> allocated);
-			if (!that -> array) {
-				fprintf(stderr, FL "Can't grow bitstream storage array (%zu bytes)\n", that -> allocated);
-				exit(EXIT_MEMORY);
-			}
-		}
+size_t bitstream_remaining(bitstream *const that) {
+	return that -> size - that -> current;
+}
+
+long bitstream_peek(bitstream *const that, int const numbits) {
+	if (numbits <= 0) {
+		return 0;
 	}
-	size_t byte_offset = that -> current / CHAR_BIT;
+	return (long)(bitstream_lookahead(that) >> (64 - numbits));
+}
+
+void bitstream_skip(bitstream *const that, size_t const numbits) {
+	if (numbits > that -> size - that -> current) {
+		that -> current = that -> size;
+	} else {
+		that -> current += numbits;
+	}
+}
+
+void bitstream_write_bit(bitstream *const that, int bit) {
+	bitstream_grow(that, that -> current / CHAR_BIT + 1);
+	size_t byte_offset = that -> current / CHAR_BIT - that -> flushed;
 	unsigned char byte = 1U << (CHAR_BIT - 1 - that -> current % CHAR_BIT);
 	if (bit) {
 		that -> array[byte_offset] |= byte;
@@ -131,15 +370,456 @@ void bitstream_write_bit(bitstream *const that, int bit) {
 		that -> array[byte_offset] &= ~byte;
 	}
 	that -> current++;
+	if (that -> current > that -> size) {
+		that -> size = that -> current;
+	}
 }
 
 void bitstream_write_value(bitstream *const that, long value, int numbits) {
-	for (int i = numbits - 1; i >= 0; i--) {
-		bitstream_write_bit(that, (value & (1L << i)) != 0);
+	if (numbits <= 0) {
+		return;
+	}
+	if (numbits > bitstream_max_word_bits) {
+		bitstream_write_value(that, value >> 32, numbits - 32);
+		bitstream_write_value(that, value, 32);
+		return;
+	}
+	bitstream_grow(that, that -> current / CHAR_BIT + bitstream_word_bytes);
+	size_t const byte_offset = that -> current / CHAR_BIT - that -> flushed;
+	int const shift = 64 - (int)(that -> current % CHAR_BIT) - numbits;
+	uint64_t const mask = ((UINT64_C(1) << numbits) - 1) << shift;
+	uint64_t word = bitstream_load_word(that -> array + byte_offset);
+	word = (word & ~mask) | (((uint64_t)value << shift) & mask);
+	bitstream_store_word(that -> array + byte_offset, word);
+	that -> current += numbits;
+	if (that -> current > that -> size) {
+		that -> size = that -> current;
+	}
+}
+
+size_t bitstream_read_bytes(bitstream *const that, unsigned char *const bytes, size_t count) {
+	if (count > (that -> size - that -> current) / CHAR_BIT) {
+		count = (that -> size - that -> current) / CHAR_BIT;
+	}
+	unsigned char const *const source = that -> array + that -> current / CHAR_BIT - that -> flushed;
+	int const shift = that -> current % CHAR_BIT;
+	if (shift == 0) {
+		memcpy(bytes, source, count);
+	} else {
+		for (size_t i = 0; i < count; i++) {
+			bytes[i] = (unsigned char)((source[i] << shift) | (source[i + 1] >> (CHAR_BIT - shift)));
+		}
+	}
+	that -> current += count * CHAR_BIT;
+	return count;
+}
+
+void bitstream_write_bytes(bitstream *const that, unsigned char const *const bytes, size_t const count) {
+	// Go in chunks so that sinks can flush as they go
+	for (size_t done = 0; done < count; done += bitstream_increment) {
+		size_t const chunk = (count - done < bitstream_increment) ? count - done : bitstream_increment;
+		bitstream_grow(that, that -> current / CHAR_BIT + chunk + 1);
+		unsigned char *const destination = that -> array + that -> current / CHAR_BIT - that -> flushed;
+		int const shift = that -> current % CHAR_BIT;
+		if (shift == 0) {
+			memcpy(destination, bytes + done, chunk);
+		} else {
+			unsigned char carry = destination[0] & (0xff << (CHAR_BIT - shift));
+			for (size_t i = 0; i < chunk; i++) {
+				destination[i] = carry | (bytes[done + i] >> shift);
+				carry = (unsigned char)(bytes[done + i] << (CHAR_BIT - shift));
+			}
+			destination[chunk] = carry | (destination[chunk] & (0xff >> shift));
+		}
+		that -> current += chunk * CHAR_BIT;
+	}
+	if (that -> current > that -> size) {
+		that -> size = that -> current;
+	}
+}
+
+/*
+ * Universal and parametrized integer codes.
+ *
+ * Writers build each code as a single value where possible. Readers find
+ * the length of variable-length prefixes by counting leading zeros or ones
+ * in a lookahead word, and only fall back to reading in smaller pieces for
+ * codes longer than the lookahead.
+ *
+ * All readers return -1 when the stream ends in the middle of a code.
+ */
+
+/* Fibonacci numbers used by the Fibonacci code, 1, 2, 3, 5... */
+static long const bitstream_fibonacci[] = {
+	1L, 2L, 3L, 5L, 8L, 13L, 21L, 34L, 55L, 89L, 144L, 233L, 377L, 610L, 987L, 1597L,
+	2584L, 4181L, 6765L, 10946L, 17711L, 28657L, 46368L, 75025L, 121393L, 196418L,
+	317811L, 514229L, 832040L, 1346269L, 2178309L, 3524578L, 5702887L, 9227465L,
+	14930352L, 24157817L, 39088169L, 63245986L, 102334155L, 165580141L, 267914296L,
+	433494437L, 701408733L, 1134903170L, 1836311903L, 2971215073L, 4807526976L,
+	7778742049L, 12586269025L, 20365011074L, 32951280099L, 53316291173L,
+	86267571272L, 139583862445L, 225851433717L, 365435296162L, 591286729879L,
+	956722026041L, 1548008755920L, 2504730781961L, 4052739537881L, 6557470319842L,
+	10610209857723L, 17167680177565L, 27777890035288L, 44945570212853L,
+	72723460248141L, 117669030460994L, 190392490709135L, 308061521170129L,
+	498454011879264L, 806515533049393L, 1304969544928657L, 2111485077978050L,
+	3416454622906707L, 5527939700884757L, 8944394323791464L, 14472334024676221L,
+	23416728348467685L, 37889062373143906L, 61305790721611591L, 99194853094755497L,
+	160500643816367088L, 259695496911122585L, 420196140727489673L,
+	679891637638612258L, 1100087778366101931L, 1779979416004714189L,
+	2880067194370816120L, 4660046610375530309L, 7540113804746346429L,
+};
+
+static int const bitstream_fibonacci_count = sizeof bitstream_fibonacci / sizeof bitstream_fibonacci[0];
+
+/* Consume a run of identical bits, return its length, or -1 if the stream ends first */
+static long bitstream_read_run(bitstream *const that, int const ones) {
+	long length = 0;
+	for (;;) {
+		uint64_t word = bitstream_lookahead(that);
+		if (ones) {
+			word = ~word;
+		}
+		int const run = word ? __builtin_clzll(word) : 64;
+		if (run < bitstream_max_word_bits) {
+			if (that -> size - that -> current <= (size_t)run) {
+				that -> current = that -> size;
+				return -1;
+			}
+			that -> current += run;
+			return length + run;
+		}
+		if (that -> size - that -> current <= (size_t)bitstream_max_word_bits) {
+			that -> current = that -> size;
+			return -1;
+		}
+		that -> current += bitstream_max_word_bits;
+		length += bitstream_max_word_bits;
+	}
+}
+
+void bitstream_write_unary(bitstream *const that, long value) {
+	while (value >= bitstream_max_word_bits) {
+		bitstream_write_value(that, -1L, bitstream_max_word_bits);
+		value -= bitstream_max_word_bits;
+	}
+	bitstream_write_value(that, ((1L << value) - 1) << 1, value + 1);
+}
+
+long bitstream_read_unary(bitstream *const that) {
+	long const ret = bitstream_read_run(that, 1);
+	if (ret >= 0) {
+		that -> current++;
+	}
+	return ret;
+}
+
+void bitstream_write_truncated(bitstream *const that, long const value, long const range) {
+	int const k = bitstream_bit_length(range) - 1;
+	long const u = (1L << (k + 1)) - range;
+	if (value < u) {
+		bitstream_write_value(that, value, k);
+	} else {
+		bitstream_write_value(that, value + u, k + 1);
+	}
+}
+
+long bitstream_read_truncated(bitstream *const that, long const range) {
+	int const k = bitstream_bit_length(range) - 1;
+	long const u = (1L << (k + 1)) - range;
+	long const value = bitstream_read_value(that, k);
+	if (value < u) {
+		return value;
+	}
+	int const bit = bitstream_read_bit(that);
+	if (bit < 0) {
+		return -1;
+	}
+	return ((value << 1) | bit) - u;
+}
+
+void bitstream_write_gamma(bitstream *const that, long const value) {
+	int const n = bitstream_bit_length(value);
+	if (2 * n - 1 <= 64) {
+		bitstream_write_value(that, value, 2 * n - 1);
+	} else {
+		bitstream_write_value(that, 0, n - 1);
+		bitstream_write_value(that, value, n);
+	}
+}
+
+long bitstream_read_gamma(bitstream *const that) {
+	uint64_t const word = bitstream_lookahead(that);
+	int const zeros = word ? __builtin_clzll(word) : 64;
+	if (2 * zeros + 1 <= bitstream_max_word_bits) {
+		size_t const length = 2 * zeros + 1;
+		if (that -> size - that -> current < length) {
+			that -> current = that -> size;
+			return -1;
+		}
+		that -> current += length;
+		return (long)(word >> (64 - length));
+	}
+	long const run = bitstream_read_run(that, 0);
+	if (run < 0 || run > 62) {
+		return -1;
+	}
+	return bitstream_read_value(that, run + 1);
+}
+
+void bitstream_write_delta(bitstream *const that, long const value) {
+	int const n = bitstream_bit_length(value);
+	bitstream_write_gamma(that, n);
+	bitstream_write_value(that, value, n - 1);
+}
+
+long bitstream_read_delta(bitstream *const that) {
+	long const n = bitstream_read_gamma(that);
+	if (n < 1 || n > 63) {
+		return -1;
+	}
+	long const low = bitstream_read_value(that, n - 1);
+	if (low < 0) {
+		return -1;
+	}
+	return (1L << (n - 1)) | low;
+}
+
+void bitstream_write_omega(bitstream *const that, long const value) {
+	long groups[8];
+	int count = 0;
+	for (long n = value; n > 1; n = bitstream_bit_length(n) - 1) {
+		groups[count++] = n;
+	}
+	while (count > 0) {
+		count--;
+		bitstream_write_value(that, groups[count], bitstream_bit_length(groups[count]));
+	}
+	bitstream_write_bit(that, 0);
+}
+
+long bitstream_read_omega(bitstream *const that) {
+	long n = 1;
+	for (;;) {
+		int const bit = bitstream_read_bit(that);
+		if (bit <= 0) {
+			return bit < 0 ? -1 : n;
+		}
+		if (n > 62) {
+			return -1;
+		}
+		long const low = bitstream_read_value(that, n);
+		if (low < 0) {
+			return -1;
+		}
+		n = (1L << n) | low;
+	}
+}
+
+void bitstream_write_even_rodeh(bitstream *const that, long const value) {
+	if (value < 4) {
+		bitstream_write_value(that, value, 3);
+		return;
+	}
+	long groups[8];
+	int count = 0;
+	for (long n = value; n >= 4; n = bitstream_bit_length(n)) {
+		groups[count++] = n;
+	}
+	while (count > 0) {
+		count--;
+		bitstream_write_value(that, groups[count], bitstream_bit_length(groups[count]));
 	}
+	bitstream_write_bit(that, 0);
+}
+
+long bitstream_read_even_rodeh(bitstream *const that) {
+	long n = bitstream_read_value(that, 3);
+	if (n < 4) {
+		return n;
+	}
+	for (;;) {
+		int const bit = bitstream_read_bit(that);
+		if (bit <= 0) {
+			return bit < 0 ? -1 : n;
+		}
+		if (n > 63) {
+			return -1;
+		}
+		long const low = bitstream_read_value(that, n - 1);
+		if (low < 0) {
+			return -1;
+		}
+		n = (1L << (n - 1)) | low;
+	}
+}
+
+void bitstream_write_golomb(bitstream *const that, long const value, long const m) {
+	bitstream_write_unary(that, value / m);
+	bitstream_write_truncated(that, value % m, m);
+}
+
+long bitstream_read_golomb(bitstream *const that, long const m) {
+	long const q = bitstream_read_unary(that);
+	if (q < 0) {
+		return -1;
+	}
+	long const r = bitstream_read_truncated(that, m);
+	if (r < 0) {
+		return -1;
+	}
+	return q * m + r;
+}
+
+void bitstream_write_rice(bitstream *const that, long const value, int const k) {
+	bitstream_write_unary(that, value >> k);
+	bitstream_write_value(that, value, k);
+}
+
+long bitstream_read_rice(bitstream *const that, int const k) {
+	long const q = bitstream_read_unary(that);
+	if (q < 0) {
+		return -1;
+	}
+	long const r = bitstream_read_value(that, k);
+	if (r < 0) {
+		return -1;
+	}
+	return (q << k) | r;
+}
+
+void bitstream_write_fibonacci(bitstream *const that, long value) {
+	int top = 0;
+	while (top + 1 < bitstream_fibonacci_count && bitstream_fibonacci[top + 1] <= value) {
+		top++;
+	}
+	if (top + 2 <= 64) {
+		uint64_t code = 1;
+		for (int i = top; i >= 0; i--) {
+			if (bitstream_fibonacci[i] <= value) {
+				value -= bitstream_fibonacci[i];
+				code |= UINT64_C(1) << (top + 1 - i);
+			}
+		}
+		bitstream_write_value(that, (long)code, top + 2);
+		return;
+	}
+	// Only the very largest values have codes that don't fit in a word
+	unsigned char bits[sizeof bitstream_fibonacci / sizeof bitstream_fibonacci[0]];
+	for (int i = top; i >= 0; i--) {
+		bits[i] = bitstream_fibonacci[i] <= value;
+		if (bits[i]) {
+			value -= bitstream_fibonacci[i];
+		}
+	}
+	for (int i = 0; i <= top; i++) {
+		bitstream_write_bit(that, bits[i]);
+	}
+	bitstream_write_bit(that, 1);
+}
+
+long bitstream_read_fibonacci(bitstream *const that) {
+	uint64_t const word = bitstream_lookahead(that);
+	uint64_t const pairs = word & (word << 1);
+	if (pairs && __builtin_clzll(pairs) + 2 <= bitstream_max_word_bits) {
+		int const last = __builtin_clzll(pairs);
+		uint64_t bits = word & (~UINT64_C(0) << (63 - last));
+		long value = 0;
+		while (bits) {
+			int const i = __builtin_clzll(bits);
+			value += bitstream_fibonacci[i];
+			bits ^= UINT64_C(1) << (63 - i);
+		}
+		that -> current += last + 2;
+		return value;
+	}
+	long value = 0;
+	int previous = 0;
+	for (int i = 0; i <= bitstream_fibonacci_count; i++) {
+		int const bit = bitstream_read_bit(that);
+		if (bit < 0) {
+			return -1;
+		}
+		if (bit && previous) {
+			return value;
+		}
+		if (bit) {
+			if (i == bitstream_fibonacci_count) {
+				return -1;
+			}
+			value += bitstream_fibonacci[i];
+		}
+		previous = bit;
+	}
+	return -1;
+}
+
+/* Patch bits that have already been written out to the sink */
+static void bitstream_patch_sink(bitstream *const that, size_t const offset, long const value, int const numbits) {
+	if (that -> sink_origin < 0) {
+		fprintf(stderr, FL "Can't patch a bitstream sink that isn't seekable\n");
+		exit(EXIT_OUTPUTFILE);
+	}
+	size_t const first = offset / CHAR_BIT;
+	size_t const count = (offset + numbits - 1) / CHAR_BIT - first + 1;
+	unsigned char bytes[9];
+	if (fflush(that -> sink)
+			|| fseek(that -> sink, that -> sink_origin + first, SEEK_SET)
+			|| fread(bytes, 1, count, that -> sink) < count) {
+		fprintf(stderr, FL "Can't read back bitstream output file\n");
+		exit(EXIT_OUTPUTFILE);
+	}
+	for (int i = 0; i < numbits; i++) {
+		size_t const bit = offset + i - first * CHAR_BIT;
+		unsigned char const mask = 1U << (CHAR_BIT - 1 - bit % CHAR_BIT);
+		if ((value >> (numbits - 1 - i)) & 1) {
+			bytes[bit / CHAR_BIT] |= mask;
+		} else {
+			bytes[bit / CHAR_BIT] &= ~mask;
+		}
+	}
+	if (fseek(that -> sink, that -> sink_origin + first, SEEK_SET)
+			|| fwrite(bytes, 1, count, that -> sink) < count
+			|| fseek(that -> sink, that -> sink_origin + that -> flushed, SEEK_SET)) {
+		fprintf(stderr, FL "Can't patch bitstream output file\n");
+		exit(EXIT_OUTPUTFILE);
+	}
+}
+
+void bitstream_patch_value(bitstream *const that, size_t const offset, long const value, int const numbits) {
+	if (numbits <= 0) {
+		return;
+	}
+	if (numbits > bitstream_max_word_bits) {
+		bitstream_patch_value(that, offset, value >> 32, numbits - 32);
+		bitstream_patch_value(that, offset + numbits - 32, value, 32);
+		return;
+	}
+	if (offset + numbits > that -> size) {
+		fprintf(stderr, FL "Patching bitstream past its end (%zu bits at %zu, size %zu)\n",
+					(size_t)numbits, offset, that -> size);
+		exit(EXIT_INVALIDSTATE);
+	}
+	size_t const memory_start = that -> flushed * CHAR_BIT;
+	if (offset < memory_start) {
+		int const sink_bits = (offset + numbits <= memory_start) ? numbits : (int)(memory_start - offset);
+		bitstream_patch_sink(that, offset, value >> (numbits - sink_bits), sink_bits);
+		if (sink_bits == numbits) {
+			return;
+		}
+		bitstream_patch_value(that, memory_start, value, numbits - sink_bits);
+		return;
+	}
+	size_t const saved = that -> current;
+	that -> current = offset;
+	bitstream_write_value(that, value, numbits);
+	that -> current = saved;
 }
 
 void bitstream_dump_to_file(bitstream *const that, char const *const filename) {
+	if (that -> sink) {
+		fprintf(stderr, FL "Can't dump a bitstream sink to a file\n");
+		exit(EXIT_INVALIDSTATE);
+	}
 	FILE* outputfile = fopen(filename, "wb");
 	fwrite(bitstream_byte_array(that), 1, bitstream_byte_size(that), outputfile);
 	fclose(outputfile);
@@ -21,15 +21,33 @@
 #define BITSTREAM_H_INCLUDED
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 typedef struct bitstream bitstream;
 
+/* Most bits that a single value read, write or peek moves through one machine word */
+extern const int bitstream_max_word_bits;
+
 bitstream* bitstream_construct();
 
 bitstream* bitstream_construct_from_file(char const *const filename);
 
+/*
+ * Construct a bitstream that writes its completed bytes to a file as it
+ * goes, keeping memory use bounded. Everything left is written out when
+ * the bitstream is destructed. Only the most recent bytes are kept in
+ * memory, so such a bitstream can't be read from.
+ */
+bitstream* bitstream_construct_sink(FILE *const file);
+
+bitstream* bitstream_construct_to_file(char const *const filename);
+
 void bitstream_destruct(bitstream *const that);
 
+/* Pre-allocate room for numbits more bits past the current position */
+void bitstream_reserve(bitstream *const that, size_t const numbits);
+
 size_t bitstream_bit_size(bitstream *const that);
 
 size_t bitstream_byte_size(bitstream *const that);
@@ -40,10 +58,86 @@ int bitstream_read_bit(bitstream *const that);
 
 long bitstream_read_value(bitstream *const that, int numbits);
 
+/* Number of bits left to read */
+size_t bitstream_remaining(bitstream *const that);
+
+/*
+ * Look at the next numbits bits (at most 57) without consuming them.
+ * Bits past the end of the stream read as zeroes.
+ */
+long bitstream_peek(bitstream *const that, int const numbits);
+
+/* Consume numbits bits, stopping at the end of the stream */
+void bitstream_skip(bitstream *const that, size_t const numbits);
+
     void bitstream_write_bit(bitstream *const that, int bit);
 
 void bitstream_write_value(bitstream *const that, long value, int numbits);
 
+/*
+ * Copy whole bytes in and out of the stream, at any bit position.
+ * Reading returns the number of bytes actually read.
+ */
+size_t bitstream_read_bytes(bitstream *const that, unsigned char *const bytes, size_t count);
+
+void bitstream_write_bytes(bitstream *const that, unsigned char const *const bytes, size_t const count);
+
+/*
+ * Integer codes. Readers return -1 when the stream ends in the middle of a code.
+ *
+ * unary: value >= 0, value 1s followed by a 0
+ * truncated: 0 <= value < range, truncated binary
+ * gamma, delta, omega: value >= 1, Elias codes
+ * even_rodeh: value >= 0
+ * golomb: value >= 0, m >= 1, unary quotient and truncated binary remainder
+ * rice: value >= 0, Golomb code with m = 2^k
+ * fibonacci: value >= 1, Zeckendorf representation followed by a 1
+ */
+void bitstream_write_unary(bitstream *const that, long value);
+long bitstream_read_unary(bitstream *const that);
+
+void bitstream_write_truncated(bitstream *const that, long const value, long const range);
+long bitstream_read_truncated(bitstream *const that, long const range);
+
+void bitstream_write_gamma(bitstream *const that, long const value);
+long bitstream_read_gamma(bitstream *const that);
+
+void bitstream_write_delta(bitstream *const that, long const value);
+long bitstream_read_delta(bitstream *const that);
+
+void bitstream_write_omega(bitstream *const that, long const value);
+long bitstream_read_omega(bitstream *const that);
+
+void bitstream_write_even_rodeh(bitstream *const that, long const value);
+long bitstream_read_even_rodeh(bitstream *const that);
+
+void bitstream_write_golomb(bitstream *const that, long const value, long const m);
+long bitstream_read_golomb(bitstream *const that, long const m);
+
+void bitstream_write_rice(bitstream *const that, long const value, int const k);
+long bitstream_read_rice(bitstream *const that, int const k);
+
+void bitstream_write_fibonacci(bitstream *const that, long value);
+long bitstream_read_fibonacci(bitstream *const that);
+
+/*
+ * Code sizes and mappings, to compute exact output sizes without writing.
+ * bit_length is the number of significant bits, 0 for 0. zigzag maps
+ * signed values to 0, -1, 1, -2, 2...
+ */
+int bitstream_bit_length(uint64_t const value);
+size_t bitstream_truncated_bits(long const value, long const range);
+size_t bitstream_gamma_bits(long const value);
+long bitstream_zigzag(long const value);
+long bitstream_unzigzag(long const value);
+
+/*
+ * Overwrite numbits bits at a given bit offset, e.g. to fill in a header
+ * once its contents are known. For sinks, patching bits that have already
+ * been written out requires the file to be seekable and readable.
+ */
+void bitstream_patch_value(bitstream *const that, size_t const offset, long const value, int const numbits);
+
 void bitstream_dump_to_file(bitstream *const that, char const *const filename);
 
 #endif /* BITSTREAM_H_INCLUDED */
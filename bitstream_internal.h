@@ -22,12 +22,23 @@
 
 #include "bitstream.h"
 
+#include <stdio.h>
+
 struct bitstream {
     size_t size;
     size_t current;
 
     unsigned char* array;
     size_t allocated;
+    int mapped;
+
+    FILE* sink;
+    int owns_sink;
+    long sink_origin;
+    size_t flushed;
 };
 
+/* Number of heap allocations of bitstream storage, for benchmarks. Mapped input files don't count. */
+extern long bitstream_allocation_count;
+
 #endif /* BITSTREAM_INTERNAL_H_INCLUDED */
@@ -29,6 +29,33 @@ gcc tests/test_bitstream.c bitstream.c exitcodes.c -O2 -Wall -Wextra -o out/bin/
 echo '(*) run bitstream tests'
 out/bin/test_bitstream || exit $?
 
+echo '(*) build symbol statistics tests'
+gcc tests/test_symbol_stats.c symbol_stats.c debug.c exitcodes.c -O2 -Wall -Wextra -o out/bin/test_symbol_stats -lm || exit $?
+
+echo '(*) run symbol statistics tests'
+out/bin/test_symbol_stats || exit $?
+
+echo '(*) build Huffman tests'
+gcc tests/test_huffman.c huffman.c symbol_stats.c bitstream.c debug.c exitcodes.c -O2 -Wall -Wextra -o out/bin/test_huffman -lm || exit $?
+
+echo '(*) run Huffman tests'
+out/bin/test_huffman || exit $?
+
+echo '(*) build ANS tests'
+gcc tests/test_ans.c ans.c symbol_stats.c bitstream.c debug.c exitcodes.c -O2 -Wall -Wextra -o out/bin/test_ans -lm || exit $?
+
+echo '(*) run ANS tests'
+out/bin/test_ans || exit $?
+
+echo '(*) build LZ78 tests'
+gcc tests/test_lz78.c lz78.c bitstream.c debug.c exitcodes.c symbol_stats.c -O2 -Wall -Wextra -o out/bin/test_lz78 -lm || exit $?
+
+echo '(*) run LZ78 tests'
+out/bin/test_lz78 || exit $?
+
+echo '(*) build bitstream benchmark'
+gcc tests/bench_bitstream.c bitstream.c exitcodes.c -O2 -Wall -Wextra -o out/bin/bench_bitstream || exit $?
+
 echo '(*) build Squeezer tool'
 gcc \
 sqz.c \
@@ -46,9 +73,11 @@ other_formats/degas.c \
 \
 sqz_formats/qs.c \
 \
+ans.c \
 huffman.c \
 lz78.c \
+symbol_stats.c \
 \
--O2 -Wall -Wextra -o out/bin/sqz || exit $?
+-O2 -Wall -Wextra -o out/bin/sqz -lm || exit $?
 
 echo '(*) BUILD SUCCESSFUL'
@@ -60,6 +60,7 @@ enum compression {
 	COMPRESSION_NONE,
 	COMPRESSION_LZ78,
 	COMPRESSION_HUFFMAN,
+	COMPRESSION_ANS,
 };
 
 extern char* cmdline_inputfilename;
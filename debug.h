@@ -31,4 +31,18 @@ extern const int VERB_NORMAL;
 extern const int VERB_VERBOSE;
 extern const int VERB_EXTRA;
 
+/*
+ * Tracing inside loops. Check TRACE_ENABLED once before the loop and
+ * only call TRACE in it when enabled. Building with -DSQZ_NO_TRACE
+ * turns both into constants, so the loops carry no trace code at all.
+ */
+#ifdef SQZ_NO_TRACE
+#define TRACE_ENABLED(level) 0
+#define TRACE(...) do { } while (0)
+#else
+#include <stdio.h>
+#define TRACE_ENABLED(level) (verbosity >= (level))
+#define TRACE(...) printf(__VA_ARGS__)
+#endif
+
 #endif /* DEBUG_H_INCLUDED */
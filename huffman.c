@@ -18,11 +18,13 @@
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
 #include "huffman_internal.h"
+#include "symbol_stats_internal.h"
 
 #include "debug.h"
 #include "exitcodes.h"
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -35,16 +37,75 @@ huffman* huffman_construct() {
 	}
 	that -> input_symbol_min = LONG_MAX;
 	that -> input_symbol_max = LONG_MIN;
+	that -> tree_format = HUFFMAN_TREE_AUTO;
 	return that;
 }
 
 void huffman_destruct(huffman *const that) {
 	if (that) {
 		free(that -> symbols);
+		free(that -> values);
+		free(that -> tree);
 	}
 	free(that);
 }
 
+/*
+ * Symbols are counted in slots. Dense processors have one slot per value
+ * in the symbol range, sparse ones have one slot per distinct value, with
+ * the values sorted in that -> values.
+ */
+long huffman_slot(huffman const *const that, long const value) {
+	return symbol_stats_find_slot(that -> values,
+				that -> slots,
+				that -> input_symbol_min,
+				that -> input_symbol_max,
+				value);
+}
+
+long huffman_slot_value(huffman const *const that, long const slot) {
+	if (!that -> values) {
+		return slot + that -> input_symbol_min;
+	}
+	return that -> values[slot];
+}
+
+void huffman_set_tiebreak(huffman *const that, enum huffman_tiebreak const tiebreak) {
+	if (!that) {
+		fprintf(stderr, FL "Setting Huffman tie-breaking on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (that -> tree) {
+		fprintf(stderr, FL "Setting Huffman tie-breaking after building tree\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> tiebreak = tiebreak;
+}
+
+void huffman_set_tree_format(huffman *const that, enum huffman_tree_format const format) {
+	if (!that) {
+		fprintf(stderr, FL "Setting Huffman tree format on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (format < HUFFMAN_TREE_NODES || format > HUFFMAN_TREE_AUTO) {
+		fprintf(stderr, FL "Unknown Huffman tree format %d\n", format);
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> tree_format = format;
+}
+
+void huffman_set_max_bits(huffman *const that, long const max_bits) {
+	if (!that) {
+		fprintf(stderr, FL "Setting Huffman maximum code length on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (max_bits < 0 || max_bits > HUFFMAN_MAX_CODE_BITS) {
+		fprintf(stderr, FL "Huffman maximum code length out of range (%ld)\n", max_bits);
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> max_bits = max_bits;
+}
+
 void huffman_compute_symbol_range(huffman *const that,
 			long const *const source_symbols,
 			long const source_size) {
@@ -69,6 +130,49 @@ void huffman_compute_symbol_range(huffman *const that,
 	}
 }
 
+static void huffman_allocate_symbols(huffman *const that, long const slots) {
+	that -> symbols = calloc(slots, sizeof(hsymbol));
+	if (!that -> symbols) {
+		fprintf(stderr, FL "Can't allocate Huffman symbols (%ld times %zu bytes)\n",
+					slots,
+					sizeof(hsymbol));
+		exit(EXIT_MEMORY);
+	}
+	that -> slots = slots;
+}
+
+/*
+ * Fill the counts from statistics of the same symbols. When the range is
+ * much wider than the number of distinct values, only keep slots for the
+ * values present, so that memory doesn't grow with the range.
+ */
+static void huffman_import_counts(huffman *const that, symbol_stats const *const stats) {
+	if (symbol_stats_dense(that -> input_symbol_min, that -> input_symbol_max, stats -> distinct)) {
+		huffman_allocate_symbols(that, that -> input_symbol_max - that -> input_symbol_min + 1);
+		for (long slot = 0; slot < stats -> slots; slot++) {
+			long const value = stats -> values ? stats -> values[slot] : slot + stats -> symbol_min;
+			that -> symbols[value - that -> input_symbol_min].count = stats -> counts[slot];
+		}
+		return;
+	}
+	huffman_allocate_symbols(that, stats -> distinct);
+	that -> values = malloc(stats -> distinct * sizeof(long));
+	if (!that -> values) {
+		fprintf(stderr, FL "Can't allocate Huffman symbol values (%ld times %zu bytes)\n",
+					stats -> distinct,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	long slot = 0;
+	for (long i = 0; i < stats -> slots; i++) {
+		if (stats -> counts[i]) {
+			that -> values[slot] = stats -> values ? stats -> values[i] : i + stats -> symbol_min;
+			that -> symbols[slot].count = stats -> counts[i];
+			slot++;
+		}
+	}
+}
+
 void huffman_compute_symbol_counts(huffman *const that,
 			long const *const source_symbols,
 			long const source_size) {
@@ -84,21 +188,20 @@ void huffman_compute_symbol_counts(huffman *const that,
 		fprintf(stderr, FL "Computing Huffman symbol counts a second time\n");
 		exit(EXIT_INVALIDSTATE);
 	}
-	that -> symbols = calloc(that -> input_symbol_max - that -> input_symbol_min + 1, sizeof(hsymbol));
-	if (!that -> symbols) {
-		fprintf(stderr, FL "Can't allocate Huffman symbols (%ld times %zu bytes)\n",
-					that -> input_symbol_max - that -> input_symbol_min + 1,
-					sizeof(hsymbol));
-		exit(EXIT_MEMORY);
-	}
-	for (long i = 0; i < source_size; i++) {
-		that -> symbols[source_symbols[i] - that -> input_symbol_min].count++;
+	symbol_stats *const stats = symbol_stats_construct();
+	symbol_stats_compute(stats, source_symbols, source_size);
+	if (stats -> symbol_min < that -> input_symbol_min || stats -> symbol_max > that -> input_symbol_max) {
+		fprintf(stderr, FL "Computing Huffman symbol counts on symbols outside the symbol range\n");
+		exit(EXIT_INVALIDSTATE);
 	}
-	if (verbosity >= VERB_EXTRA) {
-		for (long i = 0; i <= that -> input_symbol_max - that -> input_symbol_min; i++) {
-			printf("Huffman symbol count: %ld instances of %ld\n",
+	huffman_import_counts(that, stats);
+	symbol_stats_destruct(stats);
+	if (TRACE_ENABLED(VERB_EXTRA)) {
+		TRACE("Huffman symbol counts in %ld %s slots\n", that -> slots, that -> values ? "sparse" : "dense");
+		for (long i = 0; i < that -> slots; i++) {
+			TRACE("Huffman symbol count: %ld instances of %ld\n",
 					that -> symbols[i].count,
-					i + that -> input_symbol_min);
+					huffman_slot_value(that, i));
 		}
 	}
 }
@@ -116,7 +219,7 @@ void huffman_count_symbols_present(huffman *const that) {
 		fprintf(stderr, FL "Counting Huffman symbols present a second time\n");
 		exit(EXIT_INVALIDSTATE);
 	}
-	for (long i = 0; i <= that -> input_symbol_max - that -> input_symbol_min; i++) {
+	for (long i = 0; i < that -> slots; i++) {
 		if (that -> symbols[i].count > 0) {
 			that -> symbols_present++;
 		}
@@ -126,6 +229,48 @@ void huffman_count_symbols_present(huffman *const that) {
 	}
 }
 
+/*
+ * Take the range, counts and symbols present from precomputed statistics
+ * instead of scanning the symbols again.
+ */
+void huffman_import_stats(huffman *const that, symbol_stats const *const stats) {
+	if (!that) {
+		fprintf(stderr, FL "Importing Huffman symbol statistics on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (that -> symbols) {
+		fprintf(stderr, FL "Importing Huffman symbol statistics after computing counts\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (!stats -> counts) {
+		fprintf(stderr, FL "Importing Huffman symbol statistics that haven't been computed\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> input_symbol_min = stats -> symbol_min;
+	that -> input_symbol_max = stats -> symbol_max;
+	huffman_import_counts(that, stats);
+	that -> symbols_present = stats -> distinct;
+	if (verbosity >= VERB_EXTRA) {
+		printf("Huffman symbol range: %ld-%ld\n", that -> input_symbol_min, that -> input_symbol_max);
+		printf("Huffman %ld symbols present in %ld %s slots\n",
+					that -> symbols_present,
+					that -> slots,
+					that -> values ? "sparse" : "dense");
+	}
+}
+
+/* Order leaves by count, then by position, for qsort */
+static hnode const* huffman_sort_tree;
+
+static int huffman_compare_leaves(void const *const a, void const *const b) {
+	long const ia = *(long const*)a;
+	long const ib = *(long const*)b;
+	if (huffman_sort_tree[ia].count != huffman_sort_tree[ib].count) {
+		return huffman_sort_tree[ia].count < huffman_sort_tree[ib].count ? -1 : 1;
+	}
+	return (ia > ib) - (ia < ib);
+}
+
 void huffman_build_tree(huffman* const that) {
 	if (!that) {
 		fprintf(stderr, FL "Building Huffman tree on NULL object\n");
@@ -153,53 +298,70 @@ void huffman_build_tree(huffman* const that) {
 		that -> tree[i].parent = LONG_MAX;
 	}
 	long j = 0;
-	for (long i = 0; i <= that -> input_symbol_max - that -> input_symbol_min; i++) {
+	for (long i = 0; i < that -> slots; i++) {
 		if (that -> symbols[i].count != 0) {
-			that -> tree[j].value = i + that -> input_symbol_min;
+			that -> tree[j].value = huffman_slot_value(that, i);
 			that -> tree[j].count = that -> symbols[i].count;
 			that -> symbols[i].node = j;
 			j++;
 		}
 	}
 
-	// Huffman core algorithm
+	// Huffman core algorithm, with two queues: leaves sorted by count,
+	// and merged nodes, which get created in order of increasing count.
+	long *const leaves = malloc(that -> symbols_present * sizeof(long));
+	if (!leaves) {
+		fprintf(stderr, FL "Can't allocate Huffman leaf queue (%ld times %zu bytes)\n",
+					that -> symbols_present,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	for (long i = 0; i < that -> symbols_present; i++) {
+		leaves[i] = i;
+	}
+	huffman_sort_tree = that -> tree;
+	qsort(leaves, that -> symbols_present, sizeof(long), huffman_compare_leaves);
+
+	int const trace = TRACE_ENABLED(VERB_EXTRA);
+	long next_leaf = 0;
+	long next_merged = that -> symbols_present;
 	for (long i = that -> symbols_present ; i < 2 * that -> symbols_present - 1; i++) {
-		long mi1, mi2, mv1, mv2;
-		mi1 = mi2 = mv1 = mv2 = LONG_MAX;
-		for (long j = 0; j < i; j++) {
-			if (that -> tree[j].parent != LONG_MAX) {
-				continue;
-			}
-			if (mv1 > that -> tree[j].count) {
-				mv2 = mv1;
-				mi2 = mi1;
-				mv1 = that -> tree[j].count;
-				mi1 = j;
-			} else if (mv2 > that -> tree[j].count) {
-				mv2 = that -> tree[j].count;
-				mi2 = j;
+		long mi[2];
+		for (int k = 0; k < 2; k++) {
+			int take_leaf;
+			if (next_leaf == that -> symbols_present) {
+				take_leaf = 0;
+			} else if (next_merged == i) {
+				take_leaf = 1;
+			} else if (that -> tiebreak == HUFFMAN_TIES_MERGED_FIRST) {
+				take_leaf = that -> tree[leaves[next_leaf]].count < that -> tree[next_merged].count;
+			} else {
+				take_leaf = that -> tree[leaves[next_leaf]].count <= that -> tree[next_merged].count;
 			}
+			mi[k] = take_leaf ? leaves[next_leaf++] : next_merged++;
 		}
-		if (verbosity >= VERB_EXTRA) {
-			printf("Huffman core min values %ld %ld at %ld %ld\n", mv1, mv2, mi1, mi2);
+		if (trace) {
+			TRACE("Huffman core min values %ld %ld at %ld %ld\n",
+					that -> tree[mi[0]].count, that -> tree[mi[1]].count, mi[0], mi[1]);
 		}
-		that -> tree[i].child0 = mi1;
-		that -> tree[i].child1 = mi2;
-		that -> tree[i].count = mv1 + mv2;
-		that -> tree[mi1].parent = i;
-		that -> tree[mi2].parent = i;
+		that -> tree[i].child0 = mi[0];
+		that -> tree[i].child1 = mi[1];
+		that -> tree[i].count = that -> tree[mi[0]].count + that -> tree[mi[1]].count;
+		that -> tree[mi[0]].parent = i;
+		that -> tree[mi[1]].parent = i;
 	}
+	free(leaves);
 
 	// Display Huffman tree
-	if (verbosity >= VERB_EXTRA) {
+	if (trace) {
 		for (long i = 0; i < 2 * that -> symbols_present - 1; i++) {
-			printf("Huffman node %ld", i);
+			TRACE("Huffman node %ld", i);
 			if (that -> tree[i].child0 == LONG_MAX) {
-				printf(" value %ld", that -> tree[i].value);
+				TRACE(" value %ld", that -> tree[i].value);
 			} else {
-				printf(" children %ld %ld", that -> tree[i].child0, that -> tree[i].child1);
+				TRACE(" children %ld %ld", that -> tree[i].child0, that -> tree[i].child1);
 			}
-			printf(" count %ld\n", that -> tree[i].count);
+			TRACE(" count %ld\n", that -> tree[i].count);
 		}
 	}
 }
@@ -213,99 +375,1380 @@ void huffman_build_codes(huffman* const that) {
 		fprintf(stderr, FL "Building Huffman tree on processor without tree\n");
 		exit(EXIT_INVALIDSTATE);
 	}
+
+	// Code lengths are node depths. Parents always come after their
+	// children in the tree, so one pass from the root down is enough.
+	long const nodes = 2 * that -> symbols_present - 1;
+	long *const depth = malloc(nodes * sizeof(long));
+	if (!depth) {
+		fprintf(stderr, FL "Can't allocate Huffman node depths (%ld times %zu bytes)\n",
+					nodes,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	depth[nodes - 1] = 0;
+	for (long i = nodes - 2; i >= 0; i--) {
+		depth[i] = depth[that -> tree[i].parent] + 1;
+	}
 	for (long i = 0; i < that -> symbols_present; i++) {
-		for (long j = i; that -> tree[j].parent != LONG_MAX; j = that -> tree[j].parent) {
-			that -> symbols[that -> tree[i].value - that -> input_symbol_min].bits++;
+		that -> symbols[huffman_slot(that, that -> tree[i].value)].bits = depth[i];
+	}
+	free(depth);
+
+	long const limit = that -> max_bits ? that -> max_bits : HUFFMAN_MAX_CODE_BITS;
+	for (long i = 0; i < that -> symbols_present; i++) {
+		if (that -> symbols[huffman_slot(that, that -> tree[i].value)].bits > limit) {
+			huffman_limit_code_lengths(that, limit);
+			break;
 		}
 	}
 
-	if (verbosity >= VERB_EXTRA) {
-		for (long i = 0; i <= that -> input_symbol_max - that -> input_symbol_min; i++) {
-			printf("Huffman symbol value %ld ", i);
+	huffman_assign_canonical_codes(that);
+
+	if (TRACE_ENABLED(VERB_EXTRA)) {
+		for (long i = 0; i < that -> slots; i++) {
+			TRACE("Huffman symbol value %ld ", huffman_slot_value(that, i));
 			if (that -> symbols[i].count) {
-				printf("node %ld code ", that -> symbols[i].node);
+				TRACE("node %ld code ", that -> symbols[i].node);
 				for (long j = that -> symbols[i].bits - 1; j >= 0; j--) {
-					long n = that -> symbols[i].node;
-					for (long k = 0; k < j; k++) {
-						n = that -> tree[n].parent;
-					}
-					if (that -> tree[that -> tree[n].parent].child0 == n) {
-						printf("0");
-					} else {
-						printf("1");
-					}
+					TRACE("%lu", (that -> symbols[i].code >> j) & 1);
 				}
-				printf(" (%ld bits)", that -> symbols[i].bits);
+				TRACE(" (%ld bits)", that -> symbols[i].bits);
 			} else {
-				printf("not present in input");
+				TRACE("not present in input");
 			}
-			printf("\n");
+			TRACE("\n");
 		}
 	}
 }
 
+/* Order slots by count, then by position, for qsort */
+static hsymbol const* huffman_sort_symbols;
+
+static int huffman_compare_slots(void const *const a, void const *const b) {
+	long const ia = *(long const*)a;
+	long const ib = *(long const*)b;
+	if (huffman_sort_symbols[ia].count != huffman_sort_symbols[ib].count) {
+		return huffman_sort_symbols[ia].count < huffman_sort_symbols[ib].count ? -1 : 1;
+	}
+	return (ia > ib) - (ia < ib);
+}
+
 /*
- * Assume that the original symbols are at most 8 bit.
+ * Package-merge: optimal code lengths under a maximum length.
  *
- * Worst pre-processing (2D signed delta-packing) will make the range
- * 		-510..510, i.e. 0..1020 after offset.
- * The last few values might be used for meta data, e.g. BTW markers,
- *      bijective numeration, EOF marker.
- * The system will limit itself to 1025 symbols numbered 0..1024, meaning
- * 		1024 nodes numbered 1025..2048, where the root is 2048 and the
- * 		inner nodes are 1025-2047, i.e. node entries are expected to fit
- * 		in 11 bits.
- * At the bottom end, the smallest sensical Huffman tree has 3 symbols, 2
- *		nodes, 1 inner node, i.e. 2 bits per node entry.
- * It would be theoretically possible to limit the range from 4 to 11 bits
- * 		per node entry, at the cost of a little efficiency for very
- * 		small trees (8->16, 18->24 and 24->32 bits respectively for 3, 4,
- * 		and 5 symbols), but that leaves no room to store variants of
- * 		canonicalized trees and supporting those would immediately
- * 		require an extra bit somewhere that would negate the benefits.
- * 		By storing all possible values from 2 to 11, we have 6 values
- * 		left for extensions into canonicalized trees.
+ * The list for the deepest level holds the leaves sorted by count. Each
+ * shallower level merges the leaves with packages made of consecutive
+ * pairs from the level below. Taking the 2n-2 smallest items at the top
+ * level, a leaf's code length is the number of levels where it gets
+ * taken, following packages down to the pairs they're made of.
  */
+void huffman_limit_code_lengths(huffman *const that, long const limit) {
+	long const n = that -> symbols_present;
+	if (n > (1L << limit)) {
+		fprintf(stderr, FL "Can't fit %ld Huffman symbols in codes of %ld bits\n", n, limit);
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const slots = that -> slots;
+	long const items = 2 * n - 2;
+
+	long *const leaves = malloc(n * sizeof(long));
+	long *const weights = malloc(limit * items * sizeof(long));
+	unsigned char *const is_leaf = malloc(limit * items);
+	long *const list_lengths = calloc(limit, sizeof(long));
+	if (!leaves || !weights || !is_leaf || !list_lengths) {
+		fprintf(stderr, FL "Can't allocate Huffman package-merge lists (%ld levels of %ld items)\n",
+					limit,
+					items);
+		exit(EXIT_MEMORY);
+	}
+	long j = 0;
+	for (long i = 0; i < slots; i++) {
+		if (that -> symbols[i].count) {
+			leaves[j++] = i;
+		}
+	}
+	huffman_sort_symbols = that -> symbols;
+	qsort(leaves, n, sizeof(long), huffman_compare_slots);
+
+	// Level 0 is the top (length 1), level limit - 1 the deepest
+	for (long level = limit - 1; level >= 0; level--) {
+		long *const list = weights + level * items;
+		unsigned char *const list_leaf = is_leaf + level * items;
+		long const *const below = list + items;
+		long const packages = (level == limit - 1) ? 0 : list_lengths[level + 1] / 2;
+		long leaf = 0;
+		long package = 0;
+		long count = 0;
+		while (count < items && (leaf < n || package < packages)) {
+			if (package == packages
+					|| (leaf < n && that -> symbols[leaves[leaf]].count <= below[2 * package] + below[2 * package + 1])) {
+				list[count] = that -> symbols[leaves[leaf++]].count;
+				list_leaf[count] = 1;
+			} else {
+				list[count] = below[2 * package] + below[2 * package + 1];
+				list_leaf[count] = 0;
+				package++;
+			}
+			count++;
+		}
+		// Remember the list length for the level above
+		list_lengths[level] = count;
+	}
+
+	for (long i = 0; i < n; i++) {
+		that -> symbols[leaves[i]].bits = 0;
+	}
+	long taken = items;
+	for (long level = 0; level < limit && taken > 0; level++) {
+		unsigned char const *const list_leaf = is_leaf + level * items;
+		long taken_leaves = 0;
+		for (long i = 0; i < taken; i++) {
+			taken_leaves += list_leaf[i];
+		}
+		for (long i = 0; i < taken_leaves; i++) {
+			that -> symbols[leaves[i]].bits++;
+		}
+		taken = 2 * (taken - taken_leaves);
+	}
+
+	if (verbosity >= VERB_EXTRA) {
+		printf("Huffman code lengths limited to %ld bits\n", limit);
+	}
+	free(leaves);
+	free(weights);
+	free(is_leaf);
+	free(list_lengths);
+}
+
+/*
+ * Canonical Huffman codes only depend on the code lengths: codes of
+ * each length are consecutive, in increasing symbol order, and shorter
+ * codes come first. That allows storing the lengths instead of the tree.
+ */
+void huffman_assign_canonical_codes(huffman *const that) {
+	long length_counts[HUFFMAN_MAX_CODE_BITS + 1] = { 0 };
+	unsigned long next_code[HUFFMAN_MAX_CODE_BITS + 1];
+	long const slots = that -> slots;
+
+	that -> max_code_bits = 0;
+	for (long i = 0; i < slots; i++) {
+		if (that -> symbols[i].count) {
+			if (that -> symbols[i].bits > HUFFMAN_MAX_CODE_BITS) {
+				fprintf(stderr, FL "Huffman code too long (%ld bits)\n", that -> symbols[i].bits);
+				exit(EXIT_IMPLEMENTATION);
+			}
+			length_counts[that -> symbols[i].bits]++;
+			if (that -> symbols[i].bits > that -> max_code_bits) {
+				that -> max_code_bits = that -> symbols[i].bits;
+			}
+		}
+	}
+	length_counts[0] = 0;
+	unsigned long code = 0;
+	for (int bits = 1; bits <= HUFFMAN_MAX_CODE_BITS; bits++) {
+		code = (code + length_counts[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+	next_code[0] = 0;
+	for (long i = 0; i < slots; i++) {
+		if (that -> symbols[i].count) {
+			that -> symbols[i].code = next_code[that -> symbols[i].bits]++;
+		}
+	}
+}
+
+/* Order slots by code length, then by position, for qsort */
+static int huffman_compare_canonical(void const *const a, void const *const b) {
+	long const ia = *(long const*)a;
+	long const ib = *(long const*)b;
+	if (huffman_sort_symbols[ia].bits != huffman_sort_symbols[ib].bits) {
+		return huffman_sort_symbols[ia].bits < huffman_sort_symbols[ib].bits ? -1 : 1;
+	}
+	return (ia > ib) - (ia < ib);
+}
+
+/*
+ * NODES: the tree is stored as its N-1 inner nodes, each with 2 entries.
+ * Entries 0 to range-1 are symbols (relative to the offset), entries from
+ * range onward are inner nodes in the order in which they're stored.
+ * Children are always stored before their parents, such that the root is
+ * last. Header: N-1 in Elias gamma. Entries use just enough bits for
+ * range + N - 2 values.
+ */
+static void huffman_write_nodes(huffman const *const that,
+			bitstream *const stream,
+			long const *const order,
+			long const range) {
+	long const n = that -> symbols_present;
+	int const bits = bitstream_bit_length(range + n - 2);
+	bitstream_write_gamma(stream, n - 1);
+
+	long *const level = malloc(2 * n * sizeof(long));
+	if (!level) {
+		fprintf(stderr, FL "Can't allocate Huffman canonical tree (%ld symbols)\n", n);
+		exit(EXIT_MEMORY);
+	}
+	// Build levels from the deepest up: each level has its leaves in
+	// canonical order followed by the inner nodes made from the level
+	// below, and consecutive pairs become the inner nodes of the level above.
+	long next_leaf = n;
+	long inner = 0;
+	long carried = 0;
+	for (long depth = that -> max_code_bits; depth >= 1; depth--) {
+		long first_leaf = next_leaf;
+		while (first_leaf > 0 && that -> symbols[order[first_leaf - 1]].bits == depth) {
+			first_leaf--;
+		}
+		long count = 0;
+		for (long i = first_leaf; i < next_leaf; i++) {
+			level[count++] = huffman_slot_value(that, order[i]) - that -> input_symbol_min;
+		}
+		for (long i = 0; i < carried; i++) {
+			level[count++] = level[n + i];
+		}
+		next_leaf = first_leaf;
+		carried = 0;
+		for (long i = 0; i + 1 < count; i += 2) {
+			bitstream_write_value(stream, level[i], bits);
+			bitstream_write_value(stream, level[i + 1], bits);
+			level[n + carried++] = range + inner++;
+		}
+	}
+	free(level);
+}
+
+/*
+ * LEAVES: the shape of the tree in preorder, then the leaf symbols in
+ * the same order. In preorder, each leaf follows the inner nodes between
+ * it and the previous leaf, so the shape is one unary count per leaf.
+ * Symbols use just enough bits for range values.
+ *
+ * In a canonical tree, preorder visits the leaves in canonical order.
+ * After a leaf, the next node in preorder is the right sibling of its
+ * deepest ancestor (or itself) that is a left child, i.e. the code with
+ * its trailing 1s dropped.
+ */
+static void huffman_write_leaves(huffman const *const that,
+			bitstream *const stream,
+			long const *const order,
+			long const range) {
+	long const n = that -> symbols_present;
+	long depth = 0;
+	for (long i = 0; i < n; i++) {
+		hsymbol const *const symbol = that -> symbols + order[i];
+		bitstream_write_unary(stream, symbol -> bits - depth);
+		long trailing_ones = 0;
+		while (trailing_ones < symbol -> bits && ((symbol -> code >> trailing_ones) & 1)) {
+			trailing_ones++;
+		}
+		depth = symbol -> bits - trailing_ones;
+	}
+	int const bits = bitstream_bit_length(range - 1);
+	for (long i = 0; i < n; i++) {
+		bitstream_write_value(stream, huffman_slot_value(that, order[i]) - that -> input_symbol_min, bits);
+	}
+}
+
+/*
+ * LENGTHS: the code length of every value in the range, 0 for values
+ * that aren't present. Header: longest code length in Elias gamma.
+ * Lengths use just enough bits for the longest.
+ */
+static void huffman_write_lengths(huffman const *const that,
+			bitstream *const stream,
+			long const range) {
+	bitstream_write_gamma(stream, that -> max_code_bits);
+	int const bits = bitstream_bit_length(that -> max_code_bits);
+	long value = 0;
+	for (long i = 0; i < that -> slots; i++) {
+		if (that -> symbols[i].count) {
+			long const present = huffman_slot_value(that, i) - that -> input_symbol_min;
+			for (; value < present; value++) {
+				bitstream_write_value(stream, 0, bits);
+			}
+			bitstream_write_value(stream, that -> symbols[i].bits, bits);
+			value++;
+		}
+	}
+	for (; value < range; value++) {
+		bitstream_write_value(stream, 0, bits);
+	}
+}
+
+/* Span of the top level of a hierarchical bitmap */
+static long huffman_bitmap_span(long const range) {
+	long span = 1;
+	while (span < range) {
+		span *= HUFFMAN_BITMAP_FANOUT;
+	}
+	return span;
+}
+
+/* Whether any of the sorted values is in [low, high) */
+static int huffman_any_present(long const *const values, long const n, long const low, long const high) {
+	long first = 0;
+	long last = n;
+	while (first < last) {
+		long const middle = first + (last - first) / 2;
+		if (values[middle] < low) {
+			first = middle + 1;
+		} else {
+			last = middle;
+		}
+	}
+	return first < n && values[first] < high;
+}
+
+static void huffman_write_bitmap_level(bitstream *const stream,
+			long const *const values,
+			long const n,
+			long const low,
+			long const span,
+			long const range) {
+	long const child_span = span / HUFFMAN_BITMAP_FANOUT;
+	for (long child = low; child < low + span && child < range; child += child_span) {
+		bitstream_write_bit(stream, huffman_any_present(values, n, child, child + child_span));
+	}
+	if (child_span == 1) {
+		return;
+	}
+	for (long child = low; child < low + span && child < range; child += child_span) {
+		if (huffman_any_present(values, n, child, child + child_span)) {
+			huffman_write_bitmap_level(stream, values, n, child, child_span, range);
+		}
+	}
+}
 
 /*
- * Node count can range from 2 to 1024.
- * 		000xxx (8-15) -> 2-9
- * 		001xxxx (16-31) -> 10-25
- * 		010xxxxx (32-63) -> 26-57
- * 		...
- * 		111xxxxxxxxxx (1024-2047) -> 1018-2041
- * Note: there should be ways to use smaller storage for node counts
- * 		when it's known that the symbol range is shorter.
+ * BITMAP: a hierarchical bitmap of the values present, then their code
+ * lengths minus 1. Each level of the bitmap has one bit per chunk of the
+ * level below, and only non-empty chunks are stored further down.
+ * Header: longest code length in Elias gamma.
  */
+static void huffman_write_bitmap(huffman const *const that,
+			bitstream *const stream,
+			long const range) {
+	long const n = that -> symbols_present;
+	long *const values = malloc(n * sizeof(long));
+	if (!values) {
+		fprintf(stderr, FL "Can't allocate Huffman bitmap values (%ld symbols)\n", n);
+		exit(EXIT_MEMORY);
+	}
+	long j = 0;
+	for (long i = 0; i < that -> slots; i++) {
+		if (that -> symbols[i].count) {
+			values[j++] = huffman_slot_value(that, i) - that -> input_symbol_min;
+		}
+	}
+	bitstream_write_gamma(stream, that -> max_code_bits);
+	huffman_write_bitmap_level(stream, values, n, 0, huffman_bitmap_span(range), range);
+	int const bits = bitstream_bit_length(that -> max_code_bits - 1);
+	for (long i = 0; i < that -> slots; i++) {
+		if (that -> symbols[i].count) {
+			bitstream_write_value(stream, that -> symbols[i].bits - 1, bits);
+		}
+	}
+	free(values);
+}
+
+/*
+ * Every format starts with a 2-bit format number, then the symbol range
+ * and zigzag symbol offset + 1 in Elias gamma. A lone symbol is stored as
+ * the offset of a range of 1, with nothing else.
+ *
+ * The stored tree is the canonical tree, not the one built from the
+ * counts, so that readers can get the codes back from the code lengths.
+ */
+static void huffman_write_tree_format(huffman const *const that,
+			bitstream *const stream,
+			enum huffman_tree_format const format,
+			long const *const order) {
+	bitstream_write_value(stream, format, 2);
+	if (that -> symbols_present == 1) {
+		bitstream_write_gamma(stream, 1);
+		bitstream_write_gamma(stream, bitstream_zigzag(that -> tree[0].value) + 1);
+		return;
+	}
+	long const range = that -> input_symbol_max - that -> input_symbol_min + 1;
+	bitstream_write_gamma(stream, range);
+	bitstream_write_gamma(stream, bitstream_zigzag(that -> input_symbol_min) + 1);
+	switch (format) {
+		case HUFFMAN_TREE_NODES:
+			huffman_write_nodes(that, stream, order, range);
+			break;
+		case HUFFMAN_TREE_LEAVES:
+			huffman_write_leaves(that, stream, order, range);
+			break;
+		case HUFFMAN_TREE_LENGTHS:
+			huffman_write_lengths(that, stream, range);
+			break;
+		case HUFFMAN_TREE_BITMAP:
+			huffman_write_bitmap(that, stream, range);
+			break;
+		default:
+			fprintf(stderr, FL "Writing Huffman tree in unknown format %d\n", format);
+			exit(EXIT_INVALIDSTATE);
+	}
+}
+
+/* Size of a hierarchical bitmap: one bit per chunk of each non-empty chunk above */
+static size_t huffman_bitmap_bits(huffman const *const that, long const range) {
+	size_t bits = 0;
+	for (long span = huffman_bitmap_span(range); span > 1; span /= HUFFMAN_BITMAP_FANOUT) {
+		long const child_span = span / HUFFMAN_BITMAP_FANOUT;
+		long previous = -1;
+		for (long i = 0; i < that -> slots; i++) {
+			if (!that -> symbols[i].count) {
+				continue;
+			}
+			long const block = (huffman_slot_value(that, i) - that -> input_symbol_min) / span;
+			if (block != previous) {
+				long const remaining = range - block * span;
+				bits += remaining >= span ? HUFFMAN_BITMAP_FANOUT : (remaining + child_span - 1) / child_span;
+				previous = block;
+			}
+		}
+	}
+	return bits;
+}
+
+/* Exact size of the tree in a given format, without writing it */
+static size_t huffman_tree_format_bits(huffman const *const that, enum huffman_tree_format const format) {
+	long const n = that -> symbols_present;
+	if (n == 1) {
+		return 2 + bitstream_gamma_bits(1) + bitstream_gamma_bits(bitstream_zigzag(that -> tree[0].value) + 1);
+	}
+	long const range = that -> input_symbol_max - that -> input_symbol_min + 1;
+	size_t const header = 2 + bitstream_gamma_bits(range) + bitstream_gamma_bits(bitstream_zigzag(that -> input_symbol_min) + 1);
+	switch (format) {
+		case HUFFMAN_TREE_NODES:
+			return header + bitstream_gamma_bits(n - 1) + 2 * (n - 1) * bitstream_bit_length(range + n - 2);
+		case HUFFMAN_TREE_LEAVES:
+			return header + (2 * n - 1) + n * bitstream_bit_length(range - 1);
+		case HUFFMAN_TREE_LENGTHS:
+			return header + bitstream_gamma_bits(that -> max_code_bits) + range * bitstream_bit_length(that -> max_code_bits);
+		case HUFFMAN_TREE_BITMAP:
+			return header + bitstream_gamma_bits(that -> max_code_bits)
+						+ huffman_bitmap_bits(that, range)
+						+ n * bitstream_bit_length(that -> max_code_bits - 1);
+		default:
+			fprintf(stderr, FL "Sizing Huffman tree in unknown format %d\n", format);
+			exit(EXIT_INVALIDSTATE);
+	}
+}
+
+/* The selected format, or the smallest one for AUTO */
+static enum huffman_tree_format huffman_pick_tree_format(huffman const *const that) {
+	if (that -> tree_format != HUFFMAN_TREE_AUTO) {
+		return that -> tree_format;
+	}
+	enum huffman_tree_format format = HUFFMAN_TREE_NODES;
+	size_t best = SIZE_MAX;
+	for (enum huffman_tree_format f = HUFFMAN_TREE_NODES; f < HUFFMAN_TREE_AUTO; f++) {
+		size_t const bits = huffman_tree_format_bits(that, f);
+		if (verbosity >= VERB_EXTRA) {
+			printf("Huffman tree format %d needs %zu bits\n", f, bits);
+		}
+		if (bits < best) {
+			best = bits;
+			format = f;
+		}
+	}
+	return format;
+}
 
-/* Write Huffman tree */
 void huffman_write_tree(huffman *const that, bitstream *const stream) {
+	if (!that) {
+		fprintf(stderr, FL "Writing Huffman tree on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (!that -> tree) {
+		fprintf(stderr, FL "Writing Huffman tree on processor without tree\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const n = that -> symbols_present;
+	long *const order = malloc(n * sizeof(long));
+	if (!order) {
+		fprintf(stderr, FL "Can't allocate Huffman canonical order (%ld symbols)\n", n);
+		exit(EXIT_MEMORY);
+	}
+	long j = 0;
+	for (long i = 0; i < that -> slots; i++) {
+		if (that -> symbols[i].count) {
+			order[j++] = i;
+		}
+	}
+	huffman_sort_symbols = that -> symbols;
+	qsort(order, n, sizeof(long), huffman_compare_canonical);
+
+	enum huffman_tree_format const format = huffman_pick_tree_format(that);
 	if (verbosity >= VERB_EXTRA) {
-		printf("Huffman processor for %ld nodes\n", that -> symbols_present - 1);
-		printf("Huffman processor for %ld symbols\n", that -> input_symbol_max - that -> input_symbol_min + 1);
-		long t = that -> input_symbol_max - that -> input_symbol_min + that -> symbols_present - 1;
-		printf("Huffman nodes have %ld possible values\n", t);
-		long bits = 0;
-		while (t) {
-			bits++;
-			t >>= 1;
-		}
-		printf("Huffman nodes need %ld bits per entry, %ld bits per node\n", bits, 2 * bits);
-		printf("Huffman tree needs %ld bits\n", 2 * bits * (that -> symbols_present - 1));
-		printf("\n");
-		printf("Huffman node entry bit size %ld\n", bits);
-		printf("Huffman node count %ld\n", that -> symbols_present - 1);
+		printf("Huffman tree format %d\n", format);
+		printf("Huffman symbol range %ld\n", that -> input_symbol_max - that -> input_symbol_min + 1);
 		printf("Huffman symbol offset %ld\n", that -> input_symbol_min);
+	}
+	huffman_write_tree_format(that, stream, format, order);
+	free(order);
+}
+
+/* Exact number of bits needed to encode the symbols, exits on unknown symbols */
+static size_t huffman_encoded_bits(huffman const *const that,
+			long const *const symbols,
+			long const count) {
+	size_t bits = 0;
+	for (long i = 0; i < count; i++) {
+		long const slot = huffman_slot(that, symbols[i]);
+		if (slot < 0 || !that -> symbols[slot].count) {
+			fprintf(stderr, FL "Encoding symbol %ld that has no Huffman code\n", symbols[i]);
+			exit(EXIT_INVALIDSTATE);
+		}
+		bits += that -> symbols[slot].bits;
+	}
+	return bits;
+}
+
+/*
+ * Codes are gathered in a local accumulator and written out in runs of
+ * up to 57 bits, the most that the bitstream writes in one go.
+ */
+void huffman_encode(huffman *const that,
+			long const *const symbols,
+			long const count,
+			bitstream *const stream) {
+	if (!that) {
+		fprintf(stderr, FL "Encoding Huffman symbols on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (!that -> tree) {
+		fprintf(stderr, FL "Encoding Huffman symbols on processor without codes\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	bitstream_reserve(stream, huffman_encoded_bits(that, symbols, count));
+
+	unsigned long accumulator = 0;
+	int pending = 0;
+	for (long i = 0; i < count; i++) {
+		hsymbol const *const symbol = that -> symbols + huffman_slot(that, symbols[i]);
+		int const bits = symbol -> bits;
+		if (pending + bits > HUFFMAN_MAX_CODE_BITS) {
+			bitstream_write_value(stream, accumulator, pending);
+			accumulator = 0;
+			pending = 0;
+		}
+		accumulator = (accumulator << bits) | symbol -> code;
+		pending += bits;
+	}
+	if (pending) {
+		bitstream_write_value(stream, accumulator, pending);
+	}
+}
+
+/*
+ * Exact size of huffman_write_tree followed by huffman_encode of the
+ * counted symbols, from the counts and code lengths alone.
+ */
+size_t huffman_cost_bits(huffman *const that) {
+	if (!that) {
+		fprintf(stderr, FL "Computing Huffman cost on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (!that -> tree) {
+		fprintf(stderr, FL "Computing Huffman cost on processor without codes\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	size_t bits = huffman_tree_format_bits(that, huffman_pick_tree_format(that));
+	for (long i = 0; i < that -> slots; i++) {
+		bits += that -> symbols[i].count * that -> symbols[i].bits;
+	}
+	return bits;
+}
+
+huffmandecoder* huffmandecoder_construct() {
+	huffmandecoder* that = calloc(1, sizeof(huffmandecoder));
+	if (!that) {
+		fprintf(stderr, FL "Can't allocate huffmandecoder structure (%zu bytes)\n", sizeof (huffmandecoder));
+		exit(EXIT_MEMORY);
+	}
+	return that;
+}
+
+void huffmandecoder_destruct(huffmandecoder *const that) {
+	if (that) {
+		free(that -> table);
+	}
+	free(that);
+}
 
-		long coded_offset;
-		if (that -> input_symbol_min >= 0) {
-			coded_offset = that -> input_symbol_min * 2;
+/* Order decoded symbols by code length, then by value, for qsort */
+static int huffman_compare_decoded(void const *const a, void const *const b) {
+	hdecoded const *const da = a;
+	hdecoded const *const db = b;
+	if (da -> bits != db -> bits) {
+		return da -> bits < db -> bits ? -1 : 1;
+	}
+	return (da -> value > db -> value) - (da -> value < db -> value);
+}
+
+static void huffmandecoder_grow_table(huffmandecoder *const that, long const entries) {
+	that -> table = realloc(that -> table, entries * sizeof(hdecode));
+	if (!that -> table) {
+		fprintf(stderr, FL "Can't allocate Huffman decoding table (%ld times %zu bytes)\n",
+					entries,
+					sizeof(hdecode));
+		exit(EXIT_MEMORY);
+	}
+	memset(that -> table + that -> table_size, 0, (entries - that -> table_size) * sizeof(hdecode));
+	that -> table_size = entries;
+}
+
+/*
+ * Build the lookup tables from symbols and their code lengths.
+ *
+ * The primary table is indexed by the next primary_bits bits of the
+ * stream. Codes that fit are replicated across all the entries that
+ * start with them. Longer codes sharing the same first primary_bits
+ * bits get a secondary table, indexed by just enough extra bits for
+ * the longest of them.
+ */
+void huffmandecoder_build_tables(huffmandecoder *const that, hdecoded *const symbols, long const n) {
+	qsort(symbols, n, sizeof(hdecoded), huffman_compare_decoded);
+	that -> max_code_bits = symbols[n - 1].bits;
+	that -> primary_bits = that -> max_code_bits < HUFFMAN_PRIMARY_BITS ? that -> max_code_bits : HUFFMAN_PRIMARY_BITS;
+	that -> single_symbol = symbols[0].value;
+	that -> table_size = 0;
+	huffmandecoder_grow_table(that, 1L << that -> primary_bits);
+
+	int const primary = that -> primary_bits;
+	unsigned long code = 0;
+	long previous_bits = symbols[0].bits;
+	for (long i = 0; i < n; i++) {
+		int const bits = symbols[i].bits;
+		code <<= bits - previous_bits;
+		previous_bits = bits;
+		if (bits == 0) {
+			continue;
+		}
+		if (code >> bits) {
+			fprintf(stderr, "Invalid Huffman tree: oversubscribed code lengths\n");
+			exit(EXIT_BADFILE);
+		}
+		if (bits <= primary) {
+			long const first = code << (primary - bits);
+			for (long k = 0; k < (1L << (primary - bits)); k++) {
+				that -> table[first + k].value = symbols[i].value;
+				that -> table[first + k].bits = bits;
+			}
 		} else {
-			coded_offset = -that -> input_symbol_min * 2 + 1;
+			long const prefix = code >> (bits - primary);
+			if (that -> table[prefix].table_bits == 0) {
+				// Codes with the same prefix are consecutive, the last one is the longest
+				unsigned long next = code;
+				long last = i;
+				for (long k = i + 1; k < n; k++) {
+					next = (next + 1) << (symbols[k].bits - symbols[k - 1].bits);
+					if ((next >> (symbols[k].bits - primary)) != (unsigned long)prefix) {
+						break;
+					}
+					last = k;
+				}
+				int const sub_bits = symbols[last].bits - primary;
+				that -> table[prefix].value = that -> table_size;
+				that -> table[prefix].table_bits = sub_bits;
+				huffmandecoder_grow_table(that, that -> table_size + (1L << sub_bits));
+			}
+			hdecode *const sub = that -> table + that -> table[prefix].value;
+			int const sub_bits = that -> table[prefix].table_bits;
+			long const first = (code & ((1UL << (bits - primary)) - 1)) << (sub_bits - (bits - primary));
+			for (long k = 0; k < (1L << (sub_bits - (bits - primary))); k++) {
+				sub[first + k].value = symbols[i].value;
+				sub[first + k].bits = bits - primary;
+			}
 		}
+		code++;
+	}
+}
 
-		bitstream_write_value(stream, bits, 4);
-		bitstream_write_value(stream, that -> symbols_present - 1, 12);
-		bitstream_write_value(stream, coded_offset, 12);
+/* Append a symbol and its code length to a growing list */
+static void huffman_append_decoded(hdecoded **const symbols,
+			long *const n,
+			long *const allocated,
+			long const value,
+			long const bits) {
+	if (*n == *allocated) {
+		*allocated = *allocated ? 2 * *allocated : 64;
+		*symbols = realloc(*symbols, *allocated * sizeof(hdecoded));
+		if (!*symbols) {
+			fprintf(stderr, FL "Can't allocate Huffman decoded symbols (%ld times %zu bytes)\n",
+						*allocated,
+						sizeof(hdecoded));
+			exit(EXIT_MEMORY);
+		}
+	}
+	(*symbols)[*n].value = value;
+	(*symbols)[*n].bits = bits;
+	(*n)++;
+}
+
+static void huffmandecoder_read_nodes(bitstream *const stream,
+			long const range,
+			long const symbol_min,
+			hdecoded **const symbols,
+			long *const n,
+			long *const allocated) {
+	long const inner_nodes = bitstream_read_gamma(stream);
+	if (inner_nodes < 1 || inner_nodes >= range) {
+		fprintf(stderr, "Invalid Huffman tree node count %ld\n", inner_nodes);
+		exit(EXIT_BADFILE);
+	}
+	int const bits = bitstream_bit_length(range + inner_nodes - 1);
+	long *const entries = malloc(2 * inner_nodes * sizeof(long));
+	long *const depth = malloc(inner_nodes * sizeof(long));
+	if (!entries || !depth) {
+		fprintf(stderr, FL "Can't allocate Huffman tree (%ld nodes)\n", inner_nodes);
+		exit(EXIT_MEMORY);
+	}
+	for (long i = 0; i < 2 * inner_nodes; i++) {
+		entries[i] = bitstream_read_value(stream, bits);
+	}
+
+	// Children come before their parents, walk down from the root
+	for (long i = 0; i < inner_nodes - 1; i++) {
+		depth[i] = -1;
+	}
+	depth[inner_nodes - 1] = 0;
+	for (long i = inner_nodes - 1; i >= 0; i--) {
+		if (depth[i] < 0) {
+			fprintf(stderr, "Invalid Huffman tree: node %ld has no parent\n", i);
+			exit(EXIT_BADFILE);
+		}
+		for (int c = 0; c < 2; c++) {
+			long const entry = entries[2 * i + c];
+			if (entry < 0 || entry >= range + i) {
+				fprintf(stderr, "Invalid Huffman tree entry %ld in node %ld\n", entry, i);
+				exit(EXIT_BADFILE);
+			}
+			if (entry >= range) {
+				if (depth[entry - range] >= 0) {
+					fprintf(stderr, "Invalid Huffman tree: node %ld has two parents\n", entry - range);
+					exit(EXIT_BADFILE);
+				}
+				depth[entry - range] = depth[i] + 1;
+			} else {
+				if (depth[i] + 1 > HUFFMAN_MAX_CODE_BITS) {
+					fprintf(stderr, "Invalid Huffman tree shape\n");
+					exit(EXIT_BADFILE);
+				}
+				huffman_append_decoded(symbols, n, allocated, entry + symbol_min, depth[i] + 1);
+			}
+		}
+	}
+	free(entries);
+	free(depth);
+}
+
+static void huffmandecoder_read_leaves(bitstream *const stream,
+			long const range,
+			long const symbol_min,
+			hdecoded **const symbols,
+			long *const n,
+			long *const allocated) {
+	// Pending right children, the deepest last
+	long pending[HUFFMAN_MAX_CODE_BITS + 1];
+	long pending_count = 0;
+	long depth = 0;
+	for (;;) {
+		long const inner_nodes = bitstream_read_unary(stream);
+		if (inner_nodes < 0 || depth + inner_nodes > HUFFMAN_MAX_CODE_BITS || *n == range) {
+			fprintf(stderr, "Invalid Huffman tree shape\n");
+			exit(EXIT_BADFILE);
+		}
+		for (long i = 0; i < inner_nodes; i++) {
+			pending[pending_count++] = depth + i + 1;
+		}
+		huffman_append_decoded(symbols, n, allocated, 0, depth + inner_nodes);
+		if (!pending_count) {
+			break;
+		}
+		depth = pending[--pending_count];
+	}
+	int const bits = bitstream_bit_length(range - 1);
+	for (long i = 0; i < *n; i++) {
+		long const value = bitstream_read_value(stream, bits);
+		if (value < 0 || value >= range) {
+			fprintf(stderr, "Invalid Huffman tree symbol %ld\n", value);
+			exit(EXIT_BADFILE);
+		}
+		(*symbols)[i].value = value + symbol_min;
+	}
+}
+
+static void huffmandecoder_read_lengths(bitstream *const stream,
+			long const range,
+			long const symbol_min,
+			hdecoded **const symbols,
+			long *const n,
+			long *const allocated) {
+	long const max_bits = bitstream_read_gamma(stream);
+	if (max_bits < 1 || max_bits > HUFFMAN_MAX_CODE_BITS) {
+		fprintf(stderr, "Invalid Huffman code length %ld\n", max_bits);
+		exit(EXIT_BADFILE);
+	}
+	int const bits = bitstream_bit_length(max_bits);
+	for (long value = 0; value < range; value++) {
+		long const length = bitstream_read_value(stream, bits);
+		if (length < 0 || length > max_bits) {
+			fprintf(stderr, "Invalid Huffman code length %ld\n", length);
+			exit(EXIT_BADFILE);
+		}
+		if (length) {
+			huffman_append_decoded(symbols, n, allocated, value + symbol_min, length);
+		}
+	}
+}
+
+static void huffmandecoder_read_bitmap_level(bitstream *const stream,
+			long const low,
+			long const span,
+			long const range,
+			hdecoded **const symbols,
+			long *const n,
+			long *const allocated) {
+	long const child_span = span / HUFFMAN_BITMAP_FANOUT;
+	unsigned char present[HUFFMAN_BITMAP_FANOUT];
+	int children = 0;
+	for (long child = low; child < low + span && child < range; child += child_span) {
+		int const bit = bitstream_read_bit(stream);
+		if (bit < 0) {
+			fprintf(stderr, "Huffman tree bitmap ends early\n");
+			exit(EXIT_BADFILE);
+		}
+		present[children++] = bit;
+	}
+	for (int c = 0; c < children; c++) {
+		if (!present[c]) {
+			continue;
+		}
+		if (child_span == 1) {
+			huffman_append_decoded(symbols, n, allocated, low + c, 0);
+		} else {
+			huffmandecoder_read_bitmap_level(stream, low + c * child_span, child_span, range, symbols, n, allocated);
+		}
+	}
+}
+
+static void huffmandecoder_read_bitmap(bitstream *const stream,
+			long const range,
+			long const symbol_min,
+			hdecoded **const symbols,
+			long *const n,
+			long *const allocated) {
+	long const max_bits = bitstream_read_gamma(stream);
+	if (max_bits < 1 || max_bits > HUFFMAN_MAX_CODE_BITS) {
+		fprintf(stderr, "Invalid Huffman code length %ld\n", max_bits);
+		exit(EXIT_BADFILE);
+	}
+	huffmandecoder_read_bitmap_level(stream, 0, huffman_bitmap_span(range), range, symbols, n, allocated);
+	int const bits = bitstream_bit_length(max_bits - 1);
+	for (long i = 0; i < *n; i++) {
+		long const length = bitstream_read_value(stream, bits);
+		if (length < 0 || length >= max_bits) {
+			fprintf(stderr, "Invalid Huffman code length %ld\n", length + 1);
+			exit(EXIT_BADFILE);
+		}
+		(*symbols)[i].value += symbol_min;
+		(*symbols)[i].bits = length + 1;
+	}
+}
+
+void huffmandecoder_read_tree(huffmandecoder *const that, bitstream *const stream) {
+	if (!that) {
+		fprintf(stderr, FL "Reading Huffman tree on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const format = bitstream_read_value(stream, 2);
+	long const range = bitstream_read_gamma(stream);
+	long const offset = bitstream_read_gamma(stream);
+	if (format < 0 || range < 1 || range > HUFFMAN_MAX_TREE_RANGE || offset < 1) {
+		fprintf(stderr, "Invalid Huffman tree header\n");
+		exit(EXIT_BADFILE);
+	}
+	long const symbol_min = bitstream_unzigzag(offset - 1);
+
+	hdecoded* symbols = NULL;
+	long n = 0;
+	long allocated = 0;
+	if (range == 1) {
+		huffman_append_decoded(&symbols, &n, &allocated, symbol_min, 0);
+	} else {
+		switch (format) {
+			case HUFFMAN_TREE_NODES:
+				huffmandecoder_read_nodes(stream, range, symbol_min, &symbols, &n, &allocated);
+				break;
+			case HUFFMAN_TREE_LEAVES:
+				huffmandecoder_read_leaves(stream, range, symbol_min, &symbols, &n, &allocated);
+				break;
+			case HUFFMAN_TREE_LENGTHS:
+				huffmandecoder_read_lengths(stream, range, symbol_min, &symbols, &n, &allocated);
+				break;
+			case HUFFMAN_TREE_BITMAP:
+				huffmandecoder_read_bitmap(stream, range, symbol_min, &symbols, &n, &allocated);
+				break;
+		}
+		if (n < 2) {
+			fprintf(stderr, "Invalid Huffman tree: %ld symbols\n", n);
+			exit(EXIT_BADFILE);
+		}
+	}
+	huffmandecoder_build_tables(that, symbols, n);
+	free(symbols);
+}
+
+void huffmandecoder_decode(huffmandecoder *const that,
+			bitstream *const stream,
+			long *const symbols,
+			long const count) {
+	if (!that || !that -> table) {
+		fprintf(stderr, FL "Decoding Huffman symbols without a tree\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (that -> max_code_bits == 0) {
+		for (long i = 0; i < count; i++) {
+			symbols[i] = that -> single_symbol;
+		}
+		return;
+	}
+	int const max_bits = that -> max_code_bits;
+	int const primary = that -> primary_bits;
+	hdecode const *const table = that -> table;
+	size_t const available = bitstream_remaining(stream);
+	size_t consumed = 0;
+	for (long i = 0; i < count; i++) {
+		long const next = bitstream_peek(stream, max_bits);
+		hdecode entry = table[next >> (max_bits - primary)];
+		int bits = entry.bits;
+		if (entry.table_bits) {
+			int const sub_bits = entry.table_bits;
+			entry = table[entry.value + ((next >> (max_bits - primary - sub_bits)) & ((1L << sub_bits) - 1))];
+			bits = primary + entry.bits;
+		}
+		if (entry.bits == 0) {
+			fprintf(stderr, "Invalid Huffman code in stream\n");
+			exit(EXIT_BADFILE);
+		}
+		symbols[i] = entry.value;
+		bitstream_skip(stream, bits);
+		consumed += bits;
+	}
+	if (consumed > available) {
+		fprintf(stderr, "Huffman stream ends in the middle of a symbol\n");
+		exit(EXIT_BADFILE);
+	}
+}
+
+/* Processor with the same slots as another one, and the given counts */
+static huffman* huffman_construct_table(huffman const *const all,
+			long const *const counts,
+			long const smoothing) {
+	huffman *const that = huffman_construct();
+	that -> input_symbol_min = all -> input_symbol_min;
+	that -> input_symbol_max = all -> input_symbol_max;
+	huffman_allocate_symbols(that, all -> slots);
+	if (all -> values) {
+		that -> values = malloc(all -> slots * sizeof(long));
+		if (!that -> values) {
+			fprintf(stderr, FL "Can't allocate Huffman symbol values (%ld times %zu bytes)\n",
+						all -> slots,
+						sizeof(long));
+			exit(EXIT_MEMORY);
+		}
+		memcpy(that -> values, all -> values, all -> slots * sizeof(long));
+	}
+	for (long i = 0; i < all -> slots; i++) {
+		that -> symbols[i].count = counts[i] + smoothing;
+		if (that -> symbols[i].count) {
+			that -> symbols_present++;
+		}
+	}
+	huffman_build_tree(that);
+	huffman_build_codes(that);
+	return that;
+}
+
+/*
+ * Split the symbols in blocks of block_size, and pick for each block the
+ * cheapest of up to max_tables Huffman tables, in the manner of bzip2.
+ *
+ * The tables start out covering bands of the alphabet with about the same
+ * total count each. Each iteration then assigns every block to the table
+ * that codes it in the fewest bits, and rebuilds every table from the
+ * blocks assigned to it. While iterating, every count is increased by 1 so
+ * that every symbol stays codable in every table.
+ *
+ * Stream: block size and table count in Elias gamma, one selector per
+ * block as the unary position in a move-to-front list of the tables,
+ * the trees of the tables, and the Huffman codes of the symbols.
+ */
+void huffman_encode_multi(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			long const block_size,
+			long const max_tables,
+			bitstream *const stream) {
+	if (count < 1 || block_size < 1 || max_tables < 1 || max_tables > HUFFMAN_MULTI_MAX_TABLES) {
+		fprintf(stderr, FL "Invalid multi-table Huffman parameters (%ld symbols, blocks of %ld, %ld tables)\n",
+					count,
+					block_size,
+					max_tables);
+		exit(EXIT_INVALIDSTATE);
+	}
+	symbol_stats* computed = NULL;
+	symbol_stats const* st = stats;
+	if (!st) {
+		computed = symbol_stats_construct();
+		symbol_stats_compute(computed, symbols, count);
+		st = computed;
+	}
+	if (!st -> counts || st -> symbol_count != count) {
+		fprintf(stderr, FL "Encoding multi-table Huffman with statistics of other symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	huffman *const all = huffman_construct();
+	huffman_import_stats(all, st);
+	symbol_stats_destruct(computed);
+	long const slots = all -> slots;
+	long const blocks = (count + block_size - 1) / block_size;
+	long tables = max_tables;
+	if (tables > blocks) {
+		tables = blocks;
+	}
+	if (tables > all -> symbols_present) {
+		tables = all -> symbols_present;
+	}
+
+	long *const symbol_slots = malloc(count * sizeof(long));
+	long *const lengths = malloc(tables * slots * sizeof(long));
+	long *const counts = malloc(tables * slots * sizeof(long));
+	long *const selectors = malloc(blocks * sizeof(long));
+	if (!symbol_slots || !lengths || !counts || !selectors) {
+		fprintf(stderr, FL "Can't allocate multi-table Huffman state (%ld blocks, %ld tables of %ld slots)\n",
+					blocks,
+					tables,
+					slots);
+		exit(EXIT_MEMORY);
+	}
+	for (long i = 0; i < count; i++) {
+		symbol_slots[i] = huffman_slot(all, symbols[i]);
+	}
+
+	// Initial tables: free inside their band, expensive outside
+	long band_start = 0;
+	long remaining = count;
+	for (long t = 0; t < tables; t++) {
+		long const target = remaining / (tables - t);
+		long band_end = band_start;
+		long band_count = 0;
+		while (band_end < slots && (band_count < target || band_count == 0)) {
+			band_count += all -> symbols[band_end].count;
+			band_end++;
+		}
+		if (t == tables - 1) {
+			band_end = slots;
+		}
+		for (long i = 0; i < slots; i++) {
+			lengths[t * slots + i] = (i >= band_start && i < band_end) ? 0 : HUFFMAN_MULTI_OUTSIDE_COST;
+		}
+		remaining -= band_count;
+		band_start = band_end;
+	}
+
+	for (int iteration = 0; iteration < HUFFMAN_MULTI_ITERATIONS; iteration++) {
+		memset(counts, 0, tables * slots * sizeof(long));
+		for (long b = 0; b < blocks; b++) {
+			long const start = b * block_size;
+			long const end = start + block_size < count ? start + block_size : count;
+			long best = 0;
+			long best_cost = LONG_MAX;
+			for (long t = 0; t < tables; t++) {
+				long const *const table_lengths = lengths + t * slots;
+				long cost = 0;
+				for (long i = start; i < end; i++) {
+					cost += table_lengths[symbol_slots[i]];
+				}
+				if (cost < best_cost) {
+					best_cost = cost;
+					best = t;
+				}
+			}
+			selectors[b] = best;
+			for (long i = start; i < end; i++) {
+				counts[best * slots + symbol_slots[i]]++;
+			}
+		}
+		if (iteration == HUFFMAN_MULTI_ITERATIONS - 1) {
+			break;
+		}
+		for (long t = 0; t < tables; t++) {
+			huffman *const table = huffman_construct_table(all, counts + t * slots, 1);
+			for (long i = 0; i < slots; i++) {
+				lengths[t * slots + i] = table -> symbols[i].bits;
+			}
+			huffman_destruct(table);
+		}
+	}
+
+	// Drop the tables that no block picked
+	long *const renumber = malloc(tables * sizeof(long));
+	if (!renumber) {
+		fprintf(stderr, FL "Can't allocate multi-table Huffman renumbering (%ld tables)\n", tables);
+		exit(EXIT_MEMORY);
+	}
+	for (long t = 0; t < tables; t++) {
+		renumber[t] = -1;
+	}
+	for (long b = 0; b < blocks; b++) {
+		renumber[selectors[b]] = 0;
+	}
+	long used = 0;
+	for (long t = 0; t < tables; t++) {
+		if (renumber[t] == 0) {
+			memmove(counts + used * slots, counts + t * slots, slots * sizeof(long));
+			renumber[t] = used++;
+		}
+	}
+	for (long b = 0; b < blocks; b++) {
+		selectors[b] = renumber[selectors[b]];
+	}
+	free(renumber);
+
+	if (verbosity >= VERB_EXTRA) {
+		printf("Huffman multi-table: %ld blocks of %ld symbols, %ld tables\n", blocks, block_size, used);
+	}
+	bitstream_write_gamma(stream, block_size);
+	bitstream_write_gamma(stream, used);
+	if (used > 1) {
+		long mtf[HUFFMAN_MULTI_MAX_TABLES];
+		for (long t = 0; t < used; t++) {
+			mtf[t] = t;
+		}
+		for (long b = 0; b < blocks; b++) {
+			long position = 0;
+			while (mtf[position] != selectors[b]) {
+				position++;
+			}
+			bitstream_write_unary(stream, position);
+			for (; position > 0; position--) {
+				mtf[position] = mtf[position - 1];
+			}
+			mtf[0] = selectors[b];
+		}
+	}
+
+	huffman* table[HUFFMAN_MULTI_MAX_TABLES];
+	for (long t = 0; t < used; t++) {
+		table[t] = huffman_construct_table(all, counts + t * slots, 0);
+		huffman_write_tree(table[t], stream);
+	}
+	for (long b = 0; b < blocks; b++) {
+		long const start = b * block_size;
+		long const end = start + block_size < count ? start + block_size : count;
+		huffman_encode(table[selectors[b]], symbols + start, end - start, stream);
+	}
+	for (long t = 0; t < used; t++) {
+		huffman_destruct(table[t]);
+	}
+
+	free(symbol_slots);
+	free(lengths);
+	free(counts);
+	free(selectors);
+	huffman_destruct(all);
+}
+
+void huffman_decode_multi(bitstream *const stream,
+			long *const symbols,
+			long const count) {
+	long const block_size = bitstream_read_gamma(stream);
+	long const tables = bitstream_read_gamma(stream);
+	if (block_size < 1 || tables < 1 || tables > HUFFMAN_MULTI_MAX_TABLES) {
+		fprintf(stderr, "Invalid multi-table Huffman header\n");
+		exit(EXIT_BADFILE);
+	}
+	long const blocks = (count + block_size - 1) / block_size;
+	unsigned char *const selectors = calloc(blocks, 1);
+	if (!selectors) {
+		fprintf(stderr, FL "Can't allocate multi-table Huffman selectors (%ld blocks)\n", blocks);
+		exit(EXIT_MEMORY);
+	}
+	if (tables > 1) {
+		long mtf[HUFFMAN_MULTI_MAX_TABLES];
+		for (long t = 0; t < tables; t++) {
+			mtf[t] = t;
+		}
+		for (long b = 0; b < blocks; b++) {
+			long position = bitstream_read_unary(stream);
+			if (position < 0 || position >= tables) {
+				fprintf(stderr, "Invalid multi-table Huffman selector\n");
+				exit(EXIT_BADFILE);
+			}
+			long const selector = mtf[position];
+			for (; position > 0; position--) {
+				mtf[position] = mtf[position - 1];
+			}
+			mtf[0] = selector;
+			selectors[b] = selector;
+		}
+	}
+
+	huffmandecoder* table[HUFFMAN_MULTI_MAX_TABLES];
+	for (long t = 0; t < tables; t++) {
+		table[t] = huffmandecoder_construct();
+		huffmandecoder_read_tree(table[t], stream);
+	}
+	for (long b = 0; b < blocks; b++) {
+		long const start = b * block_size;
+		long const end = start + block_size < count ? start + block_size : count;
+		huffmandecoder_decode(table[selectors[b]], stream, symbols + start, end - start);
+	}
+	for (long t = 0; t < tables; t++) {
+		huffmandecoder_destruct(table[t]);
+	}
+	free(selectors);
+}
+
+/*
+ * Pick how many symbols go in a tuple. The number of possible tuples
+ * grows as range^k, and every distinct tuple costs a tree entry, so k
+ * stays small enough that each possible tuple could show up a few times.
+ */
+long huffman_choose_tuple_size(long const range, long const count) {
+	long tuple_size = 1;
+	long tuples = range;
+	while (tuple_size < HUFFMAN_MAX_TUPLE_SIZE
+				&& tuples <= (1L << HUFFMAN_MAX_TUPLE_BITS) / range
+				&& tuples * range * HUFFMAN_TUPLE_DENSITY <= count) {
+		tuples *= range;
+		tuple_size++;
+	}
+	return tuple_size;
+}
+
+/* Tuple i holds symbols i*k to i*k+k-1, the first one in the lowest digit */
+static long huffman_pack_tuples(long const *const symbols,
+			long const count,
+			long const symbol_min,
+			long const range,
+			long const tuple_size,
+			long *const tuples) {
+	long const tuple_count = (count + tuple_size - 1) / tuple_size;
+	for (long t = 0; t < tuple_count; t++) {
+		long value = 0;
+		long const first = t * tuple_size;
+		long last = first + tuple_size - 1;
+		if (last >= count) {
+			last = count - 1;
+		}
+		for (long i = last; i >= first; i--) {
+			value = value * range + symbols[i] - symbol_min;
+		}
+		tuples[t] = value;
+	}
+	return tuple_count;
+}
+
+static void huffman_unpack_tuples(long const *const tuples,
+			long const symbol_min,
+			long const range,
+			long const tuple_size,
+			long *const symbols,
+			long const count) {
+	long const tuple_count = (count + tuple_size - 1) / tuple_size;
+	for (long t = 0; t < tuple_count; t++) {
+		long value = tuples[t];
+		for (long i = t * tuple_size; i < (t + 1) * tuple_size && i < count; i++) {
+			symbols[i] = value % range + symbol_min;
+			value /= range;
+		}
+	}
+}
+
+/*
+ * Code k consecutive symbols at once, so that small alphabets can go
+ * below 1 bit per symbol. Tuples are numbered in base range, and counted
+ * in sparse slots when few of the possible tuples show up.
+ *
+ * Stream: tuple size, symbol range and zigzag symbol offset + 1 in Elias
+ * gamma, then the tree and the codes of the tuples.
+ */
+void huffman_encode_tuples(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			bitstream *const stream) {
+	if (count < 1) {
+		fprintf(stderr, FL "Encoding Huffman tuples without symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	symbol_stats* computed = NULL;
+	symbol_stats const* st = stats;
+	if (!st) {
+		computed = symbol_stats_construct();
+		symbol_stats_compute(computed, symbols, count);
+		st = computed;
+	}
+	if (!st -> counts || st -> symbol_count != count) {
+		fprintf(stderr, FL "Encoding Huffman tuples with statistics of other symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const symbol_min = st -> symbol_min;
+	long const range = st -> symbol_max - symbol_min + 1;
+	symbol_stats_destruct(computed);
+	long const tuple_size = huffman_choose_tuple_size(range, count);
+	if (verbosity >= VERB_EXTRA) {
+		printf("Huffman tuples of %ld symbols over a range of %ld\n", tuple_size, range);
+	}
+
+	long *const tuples = malloc((count + tuple_size - 1) / tuple_size * sizeof(long));
+	if (!tuples) {
+		fprintf(stderr, FL "Can't allocate Huffman tuples (%ld symbols)\n", count);
+		exit(EXIT_MEMORY);
+	}
+	long const tuple_count = huffman_pack_tuples(symbols, count, symbol_min, range, tuple_size, tuples);
+
+	bitstream_write_gamma(stream, tuple_size);
+	bitstream_write_gamma(stream, range);
+	bitstream_write_gamma(stream, bitstream_zigzag(symbol_min) + 1);
+	huffman *const h = huffman_construct();
+	huffman_compute_symbol_range(h, tuples, tuple_count);
+	huffman_compute_symbol_counts(h, tuples, tuple_count);
+	huffman_count_symbols_present(h);
+	huffman_build_tree(h);
+	huffman_build_codes(h);
+	huffman_write_tree(h, stream);
+	huffman_encode(h, tuples, tuple_count, stream);
+	huffman_destruct(h);
+	free(tuples);
+}
+
+void huffman_decode_tuples(bitstream *const stream,
+			long *const symbols,
+			long const count) {
+	long const tuple_size = bitstream_read_gamma(stream);
+	long const range = bitstream_read_gamma(stream);
+	long const offset = bitstream_read_gamma(stream);
+	if (tuple_size < 1 || tuple_size > HUFFMAN_MAX_TUPLE_SIZE || range < 1 || offset < 1) {
+		fprintf(stderr, "Invalid Huffman tuple header\n");
+		exit(EXIT_BADFILE);
+	}
+	long const tuple_count = (count + tuple_size - 1) / tuple_size;
+	long *const tuples = malloc(tuple_count * sizeof(long));
+	if (!tuples) {
+		fprintf(stderr, FL "Can't allocate Huffman tuples (%ld tuples)\n", tuple_count);
+		exit(EXIT_MEMORY);
 	}
+	huffmandecoder *const decoder = huffmandecoder_construct();
+	huffmandecoder_read_tree(decoder, stream);
+	huffmandecoder_decode(decoder, stream, tuples, tuple_count);
+	huffmandecoder_destruct(decoder);
+	huffman_unpack_tuples(tuples, bitstream_unzigzag(offset - 1), range, tuple_size, symbols, count);
+	free(tuples);
 }
@@ -25,15 +25,53 @@
 #define HUFFMAN_H_INCLUDED
 
 #include "bitstream.h"
+#include "symbol_stats.h"
+
+/* Most tables in multi-table mode */
+#define HUFFMAN_MULTI_MAX_TABLES 6
 
 typedef struct huffman huffman;
 
+typedef struct huffmandecoder huffmandecoder;
+
+/*
+ * Tie-breaking between nodes of equal counts while building the tree.
+ * Picking leaves first gives the code with the smallest variance and
+ * the smallest maximum length among all optimal codes. Picking merged
+ * nodes first gives the same total size with deeper trees.
+ */
+enum huffman_tiebreak {
+	HUFFMAN_TIES_LEAVES_FIRST = 0,
+	HUFFMAN_TIES_MERGED_FIRST,
+};
+
+/*
+ * Ways to store a Huffman tree. AUTO writes whichever of the others is
+ * the smallest for the tree at hand.
+ */
+enum huffman_tree_format {
+	HUFFMAN_TREE_NODES = 0,
+	HUFFMAN_TREE_LEAVES,
+	HUFFMAN_TREE_LENGTHS,
+	HUFFMAN_TREE_BITMAP,
+	HUFFMAN_TREE_AUTO,
+};
+
 /* Construct a Huffman processor */
 huffman* huffman_construct();
 
 /* Destruct a Huffman processor */
 void huffman_destruct(huffman *const that);
 
+/* Select tie-breaking for tree construction */
+void huffman_set_tiebreak(huffman *const that, enum huffman_tiebreak const tiebreak);
+
+/* Select how the tree is stored (HUFFMAN_TREE_AUTO by default) */
+void huffman_set_tree_format(huffman *const that, enum huffman_tree_format const format);
+
+/* Limit code lengths to max_bits (0 for no limit other than the implementation's) */
+void huffman_set_max_bits(huffman *const that, long const max_bits);
+
 /* Compute range of input symbols */
 void huffman_compute_symbol_range(huffman *const that,
 			long const *const source_symbols,
@@ -47,6 +85,9 @@ void huffman_compute_symbol_counts(huffman *const that,
 /* Count symbols present */
 void huffman_count_symbols_present(huffman *const that);
 
+/* Take symbol range, counts and symbols present from statistics */
+void huffman_import_stats(huffman *const that, symbol_stats const *const stats);
+
 /* Build Huffman tree */
 void huffman_build_tree(huffman *const that);
 
@@ -56,4 +97,61 @@ void huffman_build_codes(huffman *const that);
 /* Write Huffman tree */
 void huffman_write_tree(huffman *const that, bitstream *const stream);
 
+/* Encode count symbols with the Huffman codes */
+void huffman_encode(huffman *const that,
+			long const *const symbols,
+			long const count,
+			bitstream *const stream);
+
+/* Exact bits for the tree and the counted symbols, without writing them */
+size_t huffman_cost_bits(huffman *const that);
+
+/* Construct a Huffman decoder */
+huffmandecoder* huffmandecoder_construct();
+
+/* Destruct a Huffman decoder */
+void huffmandecoder_destruct(huffmandecoder *const that);
+
+/* Read a Huffman tree written by huffman_write_tree */
+void huffmandecoder_read_tree(huffmandecoder *const that, bitstream *const stream);
+
+/* Decode count symbols */
+void huffmandecoder_decode(huffmandecoder *const that,
+			bitstream *const stream,
+			long *const symbols,
+			long const count);
+
+/*
+ * Encode count symbols with one of up to max_tables tables per block,
+ * with their statistics if already computed, NULL otherwise
+ */
+void huffman_encode_multi(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			long const block_size,
+			long const max_tables,
+			bitstream *const stream);
+
+/* Decode count symbols written by huffman_encode_multi */
+void huffman_decode_multi(bitstream *const stream,
+			long *const symbols,
+			long const count);
+
+/* Number of symbols per tuple for a symbol range and count */
+long huffman_choose_tuple_size(long const range, long const count);
+
+/*
+ * Encode count symbols as Huffman-coded tuples of consecutive symbols,
+ * with their statistics if already computed, NULL otherwise
+ */
+void huffman_encode_tuples(long const *const symbols,
+			long const count,
+			symbol_stats const *const stats,
+			bitstream *const stream);
+
+/* Decode count symbols written by huffman_encode_tuples */
+void huffman_decode_tuples(bitstream *const stream,
+			long *const symbols,
+			long const count);
+
 #endif
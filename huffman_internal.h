@@ -22,10 +22,14 @@
 
 #include "huffman.h"
 
+/* Longest code that fits in a single bitstream_write_value */
+#define HUFFMAN_MAX_CODE_BITS 57
+
 typedef struct hsymbol {
 	long count;
 	long node;
 	long bits;
+	unsigned long code;
 } hsymbol;
 
 typedef struct hnode {
@@ -40,8 +44,74 @@ struct huffman {
 	long input_symbol_min;
 	long input_symbol_max;
 	hsymbol* symbols;
+	long slots;
+	long* values;
 	long symbols_present;
 	hnode* tree;
+	enum huffman_tiebreak tiebreak;
+	long max_code_bits;
+	long max_bits;
+	enum huffman_tree_format tree_format;
 };
 
+/* Chunks per level in hierarchical bitmap trees */
+#define HUFFMAN_BITMAP_FANOUT 8
+
+/* Widest symbol range accepted when reading a tree */
+#define HUFFMAN_MAX_TREE_RANGE (1L << 60)
+
+/* Refinement passes of multi-table mode */
+#define HUFFMAN_MULTI_ITERATIONS 4
+
+/* Initial cost of symbols outside of a table's band in multi-table mode */
+#define HUFFMAN_MULTI_OUTSIDE_COST 15
+
+/* Most symbols per tuple */
+#define HUFFMAN_MAX_TUPLE_SIZE 16
+
+/* Tuple values stay below 2 to this power */
+#define HUFFMAN_MAX_TUPLE_BITS 48
+
+/* Input symbols per possible tuple needed to grow tuples */
+#define HUFFMAN_TUPLE_DENSITY 8
+
+/* Slot holding a symbol value, -1 if the value has no slot */
+long huffman_slot(huffman const *const that, long const value);
+
+/* Symbol value held in a slot */
+long huffman_slot_value(huffman const *const that, long const slot);
+
+/* Bits looked up at once by the primary decoding table */
+#define HUFFMAN_PRIMARY_BITS 10
+
+/* Decoding table entry: a symbol and its code length, or a secondary table */
+typedef struct hdecode {
+	long value;
+	unsigned char bits;
+	unsigned char table_bits;
+} hdecode;
+
+/* A symbol read from a tree, with its code length */
+typedef struct hdecoded {
+	long value;
+	long bits;
+} hdecoded;
+
+struct huffmandecoder {
+	hdecode* table;
+	long table_size;
+	int primary_bits;
+	int max_code_bits;
+	long single_symbol;
+};
+
+/* Build decoding tables from symbols and their code lengths, sorts symbols */
+void huffmandecoder_build_tables(huffmandecoder *const that, hdecoded *const symbols, long const n);
+
+/* Recompute code lengths in symbols[].bits so that none exceeds limit */
+void huffman_limit_code_lengths(huffman *const that, long const limit);
+
+/* Assign canonical codes from the code lengths in symbols[].bits */
+void huffman_assign_canonical_codes(huffman *const that);
+
 #endif /* HUFFMAN_INTERNAL_H_INCLUDED */
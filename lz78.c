@@ -18,6 +18,7 @@
 // SPDX-License-Identifier: AGPL-3.0-or-later
 
 #include "lz78_internal.h"
+#include "symbol_stats_internal.h"
 
 #include "debug.h"
 #include "exitcodes.h"
@@ -25,6 +26,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 lz78encoder* lz78encoder_construct() {
 	lz78encoder* that = calloc(1, sizeof(lz78encoder));
@@ -39,12 +41,44 @@ lz78encoder* lz78encoder_construct() {
 
 void lz78encoder_destruct(lz78encoder *const that) {
 	if (that) {
-		free(that -> stream_nodes);
-		free(that -> stream_symbols);
+		free(that -> tokens.nodes);
+		free(that -> tokens.ranges);
+		free(that -> tokens.symbols);
+		free(that -> trie.children);
+		free(that -> trie.hash);
+		free(that -> bound.parents);
+		free(that -> bound.symbols);
+		free(that -> bound.child_counts);
+		free(that -> bound.prev);
+		free(that -> bound.next);
 	}
 	free(that);
 }
 
+void lz78encoder_set_max_entries(
+			lz78encoder *const that,
+			long const max_entries,
+			enum lz78_policy const policy) {
+	if (!that) {
+		fprintf(stderr, FL "Setting LZ78 dictionary bound on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (that -> trie.nodes) {
+		fprintf(stderr, FL "Setting LZ78 dictionary bound after matching\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (max_entries < 0 || max_entries >= UINT32_MAX) {
+		fprintf(stderr, FL "LZ78 dictionary bound out of range (%ld)\n", max_entries);
+		exit(EXIT_INVALIDSTATE);
+	}
+	if ((unsigned)policy >= LZ78_POLICIES) {
+		fprintf(stderr, FL "Unknown LZ78 full dictionary policy (%d)\n", policy);
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> bound.max_entries = max_entries;
+	that -> bound.policy = policy;
+}
+
 void lz78encoder_compute_symbol_range(
 			lz78encoder *const that,
 			long const *const symbols,
@@ -57,47 +91,560 @@ void lz78encoder_compute_symbol_range(
 			that -> input_symbol_max = symbols[i];
 		}
 	}
-	printf("min symbol %ld max symbol %ld\n",
-				that -> input_symbol_min,
-				that -> input_symbol_max);
+	if (verbosity >= VERB_EXTRA) {
+		printf("LZ78 symbol range: %ld-%ld\n",
+					that -> input_symbol_min,
+					that -> input_symbol_max);
+	}
+}
+
+void lz78encoder_import_stats(
+			lz78encoder *const that,
+			symbol_stats const *const stats) {
+	if (!that) {
+		fprintf(stderr, FL "Importing LZ78 symbol statistics on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (!stats || !stats -> counts) {
+		fprintf(stderr, FL "Importing LZ78 symbol statistics that haven't been computed\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> input_symbol_min = symbol_stats_min(stats);
+	that -> input_symbol_max = symbol_stats_max(stats);
+}
+
+static void lz78_reserve_tokens(lz78tokens *const tokens, long const allocated) {
+	tokens -> nodes = realloc(tokens -> nodes, allocated * sizeof(long));
+	tokens -> ranges = realloc(tokens -> ranges, allocated * sizeof(long));
+	tokens -> symbols = realloc(tokens -> symbols, allocated * sizeof(long));
+	if (!tokens -> nodes || !tokens -> ranges || !tokens -> symbols) {
+		fprintf(stderr, FL "Can't allocate LZ78 tokens (%ld times %zu bytes)\n",
+					allocated,
+					3 * sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	tokens -> allocated = allocated;
+}
+
+static long lz78_node_id(long const node) {
+	return node ? node + 2 : 0;
+}
+
+static void* lz78_bound_alloc(long const count, size_t const size) {
+	void *const ret = calloc(count, size);
+	if (!ret) {
+		fprintf(stderr, FL "Can't allocate LZ78 dictionary bookkeeping (%ld times %zu bytes)\n",
+					count,
+					size);
+		exit(EXIT_MEMORY);
+	}
+	return ret;
+}
+
+static int lz78_uses_leaf_list(lz78bound const *const bound) {
+	return bound -> policy == LZ78_FULL_EVICT_LEAF || bound -> policy == LZ78_FULL_EVICT_LEAVES;
+}
+
+static void lz78_list_unlink(lz78bound *const bound, uint32_t const node) {
+	uint32_t const prev = bound -> prev[node];
+	uint32_t const next = bound -> next[node];
+	if (prev) {
+		bound -> next[prev] = next;
+	} else {
+		bound -> head = next;
+	}
+	if (next) {
+		bound -> prev[next] = prev;
+	} else {
+		bound -> tail = prev;
+	}
+}
+
+/* Link node after prev, or at the head when prev is 0 */
+static void lz78_list_insert(lz78bound *const bound, uint32_t const node, uint32_t const prev) {
+	uint32_t const next = prev ? bound -> next[prev] : bound -> head;
+	bound -> prev[node] = prev;
+	bound -> next[node] = next;
+	if (prev) {
+		bound -> next[prev] = node;
+	} else {
+		bound -> head = node;
+	}
+	if (next) {
+		bound -> prev[next] = node;
+	} else {
+		bound -> tail = node;
+	}
+}
+
+/* Move a match and its prefixes to the head, prefixes first */
+static void lz78_touch(lz78bound *const bound, uint32_t node) {
+	while (node) {
+		lz78_list_unlink(bound, node);
+		lz78_list_insert(bound, node, 0);
+		node = bound -> parents[node];
+	}
+}
+
+/* Remove a leaf that is already out of the lists, and free its node */
+static void lz78_remove_leaf(lz78encoder *const that, uint32_t const node) {
+	lz78bound *const bound = &that -> bound;
+	uint32_t const parent = bound -> parents[node];
+	lz78encoder_remove_child(that, parent, bound -> symbols[node]);
+	if (--bound -> child_counts[parent] == 0 && parent && lz78_uses_leaf_list(bound)) {
+		lz78_list_insert(bound, parent, 0);
+	}
+	bound -> next[node] = bound -> free;
+	bound -> free = node;
+	bound -> entries--;
+}
+
+/* Remove all the leaves but the one being extended */
+static void lz78_remove_leaves(lz78encoder *const that, uint32_t const keep) {
+	lz78bound *const bound = &that -> bound;
+	uint32_t node = bound -> head;
+	bound -> head = 0;
+	bound -> tail = 0;
+	while (node) {
+		uint32_t const next = bound -> next[node];
+		if (node == keep) {
+			lz78_list_insert(bound, node, 0);
+		} else {
+			lz78_remove_leaf(that, node);
+		}
+		node = next;
+	}
 }
 
+static void lz78_clear(lz78encoder *const that) {
+	lz78trie *const trie = &that -> trie;
+	if (trie -> width <= LZ78_DENSE_WIDTH) {
+		memset(trie -> children, 0, trie -> nodes * trie -> width * sizeof(uint32_t));
+	} else if (trie -> hash) {
+		memset(trie -> hash, 0, trie -> hash_slots * sizeof(lz78hashentry));
+		trie -> hash_used = 0;
+	}
+	trie -> nodes = 1;
+	that -> bound.entries = 0;
+	that -> bound.child_counts[0] = 0;
+	that -> bound.head = 0;
+	that -> bound.tail = 0;
+	that -> bound.free = 0;
+}
+
+/*
+ * Add the entry for parent + symbol to a bounded dictionary, making
+ * room as the policy says when full. Eviction never removes the parent
+ * being extended. EVICT_LEAF then takes the next oldest leaf and
+ * EVICT_LEAVES removes all the others, so the entry is only dropped
+ * when the parent is the last leaf. EVICT_LRU drops the entry when the
+ * parent is the least recently used one.
+ * Returns the new node, 0 when no entry was added.
+ */
+static long lz78_bounded_add(lz78encoder *const that, uint32_t const parent, long const symbol) {
+	lz78bound *const bound = &that -> bound;
+	if (bound -> policy == LZ78_FULL_EVICT_LRU) {
+		lz78_touch(bound, parent);
+	}
+	if (bound -> entries == bound -> max_entries) {
+		switch (bound -> policy) {
+			case LZ78_FULL_STOP:
+				return 0;
+			case LZ78_FULL_CLEAR:
+				lz78_clear(that);
+				return 0;
+			case LZ78_FULL_EVICT_LRU:
+			case LZ78_FULL_EVICT_LEAF: {
+				uint32_t victim = bound -> tail;
+				if (victim == parent && bound -> policy == LZ78_FULL_EVICT_LEAF) {
+					victim = bound -> prev[victim];
+				}
+				if (!victim || victim == parent) {
+					return 0;
+				}
+				lz78_list_unlink(bound, victim);
+				lz78_remove_leaf(that, victim);
+				break;
+			}
+			case LZ78_FULL_EVICT_LEAVES:
+				lz78_remove_leaves(that, parent);
+				if (bound -> entries == bound -> max_entries) {
+					return 0;
+				}
+				break;
+		}
+	}
+	uint32_t node;
+	if (bound -> free) {
+		node = bound -> free;
+		bound -> free = bound -> next[node];
+	} else {
+		node = lz78encoder_add_node(that);
+	}
+	lz78encoder_set_child(that, parent, symbol, node);
+	bound -> parents[node] = parent;
+	bound -> symbols[node] = symbol;
+	bound -> child_counts[node] = 0;
+	bound -> entries++;
+	if (lz78_uses_leaf_list(bound)) {
+		if (bound -> child_counts[parent]++ == 0 && parent) {
+			lz78_list_unlink(bound, parent);
+		}
+		lz78_list_insert(bound, node, 0);
+	} else {
+		bound -> child_counts[parent]++;
+		if (bound -> policy == LZ78_FULL_EVICT_LRU) {
+			lz78_list_insert(bound, node, parent);
+		}
+	}
+	return node;
+}
+
+/* Dictionary with only the root, shared by the encoder and the decoder */
+static long lz78_start_dictionary(lz78encoder *const that) {
+	that -> trie.width = that -> input_symbol_max - that -> input_symbol_min + 1;
+	long const root = lz78encoder_add_node(that);
+	lz78bound *const bound = &that -> bound;
+	if (bound -> max_entries && !bound -> parents) {
+		bound -> parents = lz78_bound_alloc(bound -> max_entries + 1, sizeof(uint32_t));
+		bound -> symbols = lz78_bound_alloc(bound -> max_entries + 1, sizeof(long));
+		bound -> child_counts = lz78_bound_alloc(bound -> max_entries + 1, sizeof(uint32_t));
+		bound -> prev = lz78_bound_alloc(bound -> max_entries + 1, sizeof(uint32_t));
+		bound -> next = lz78_bound_alloc(bound -> max_entries + 1, sizeof(uint32_t));
+	}
+	return root;
+}
+
+/* Add parent + symbol to the dictionary, returns the new node, 0 when none was added */
+static long lz78_add_entry(lz78encoder *const that, long const parent, long const symbol) {
+	if (that -> bound.max_entries) {
+		return lz78_bounded_add(that, parent, symbol);
+	}
+	long const node = lz78encoder_add_node(that);
+	lz78encoder_set_child(that, parent, symbol, node);
+	return node;
+}
+
+/*
+ * Each token is the longest match in the dictionary, followed by the
+ * symbol after it, and adds that match + symbol to the dictionary. When
+ * the input ends within a match, the last token has no symbol.
+ */
 void lz78encoder_find_matches(
 			lz78encoder *const that,
 			long const *const symbols,
 			long const symbol_count) {
-	lz78trie *const root = lz78encoder_construct_trie(that);
-	long next_node = 3;
+	long const root = lz78_start_dictionary(that);
+	that -> input_symbol_count = symbol_count;
+	if (that -> tokens.allocated == 0) {
+		lz78_reserve_tokens(&that -> tokens, symbol_count / LZ78_TOKENS_PER_SYMBOL_DIVISOR + LZ78_TOKENS_EXTRA);
+	}
+	int const trace = TRACE_ENABLED(VERB_EXTRA);
 	for (long i = 0; i < symbol_count; i++) {
-		lz78trie* search = root;
-		printf("looking for match for symbol %ld at offset %ld\n", symbols[i], i);
-		while (i < symbol_count && search -> next_level[symbols[i] - that -> input_symbol_min]) {
-			printf("found partial match for offset %ld\n", i);
-			search = search -> next_level[symbols[i] - that -> input_symbol_min];
+		long search = root;
+		long child;
+		while (i < symbol_count && (child = lz78encoder_child(that, search, symbols[i] - that -> input_symbol_min))) {
+			search = child;
 			i++;
 		}
-		printf("outputing node %ld\n", search -> node_id);
-
-		printf("outputing literal %ld at offset %ld\n", (i < symbol_count) ? symbols[i] : - 1, i);
+		if (i == symbol_count) {
+			if (trace) {
+				TRACE("LZ78 node %ld at end of input\n", lz78_node_id(search));
+			}
+			lz78encoder_output_node(that, lz78_node_id(search));
+			break;
+		}
+		if (trace) {
+			TRACE("LZ78 node %ld literal %ld at offset %ld\n", lz78_node_id(search), symbols[i], i);
+		}
+		lz78encoder_output_entry(that, lz78_node_id(search), symbols[i]);
+		lz78_add_entry(that, search, symbols[i] - that -> input_symbol_min);
+	}
+	if (verbosity >= VERB_EXTRA) {
+		printf("LZ78 %ld tokens, %ld literals\n", that -> tokens.num_nodes, that -> tokens.num_symbols);
+	}
+}
 
-		printf("creating node %ld\n", next_node);
-		lz78trie *const next = lz78encoder_construct_trie(that);
-		next -> node_id = next_node;
-		search -> next_level[symbols[i] - that -> input_symbol_min] = next;
-		next_node++;
+void lz78encoder_output_node(lz78encoder* const that, long const node_id) {
+	lz78tokens *const tokens = &that -> tokens;
+	if (tokens -> num_nodes == tokens -> allocated) {
+		lz78_reserve_tokens(tokens, 2 * tokens -> allocated + LZ78_TOKENS_EXTRA);
 	}
+	tokens -> ranges[tokens -> num_nodes] = that -> trie.nodes;
+	tokens -> nodes[tokens -> num_nodes++] = node_id;
 }
 
 void lz78encoder_output_entry(lz78encoder* const that, long const node_id, long const symbol) {
-	that -> stream_num_nodes++;
-	that -> stream_nodes = realloc(that -> stream_nodes, that -> stream_num_nodes * sizeof (long));
-	that -> stream_nodes[that -> stream_num_nodes - 1] = node_id;
-	that -> stream_num_symbols++;
-	that -> stream_symbols = realloc(that -> stream_symbols, that -> stream_num_symbols * sizeof (long));
-	that -> stream_symbols[that -> stream_num_symbols - 1] = symbol;
+	lz78encoder_output_node(that, node_id);
+	that -> tokens.symbols[that -> tokens.num_symbols++] = symbol;
+}
+
+long lz78encoder_token_count(lz78encoder const *const that) {
+	return that -> tokens.num_nodes;
+}
+
+long const* lz78encoder_token_nodes(lz78encoder const *const that) {
+	return that -> tokens.nodes;
+}
+
+long lz78encoder_literal_count(lz78encoder const *const that) {
+	return that -> tokens.num_symbols;
+}
+
+long const* lz78encoder_token_symbols(lz78encoder const *const that) {
+	return that -> tokens.symbols;
+}
+
+/* Nodes are numbered from 3 on, with the root as 0 */
+static long lz78_node_index(long const node_id) {
+	return node_id ? node_id - 2 : 0;
+}
+
+/*
+ * Header: symbol count + 1, symbol range, zigzag symbol offset + 1 and
+ * dictionary bound + 1, in Elias gamma, then the full dictionary policy
+ * in truncated binary if bounded. Each token is its node in truncated
+ * binary among the trie nodes that exist at that point (t + 1 for token
+ * t without a bound), then its symbol in just enough bits for the range.
+ */
+void lz78encoder_write(lz78encoder *const that, bitstream *const stream) {
+	if (that -> input_symbol_min > that -> input_symbol_max) {
+		fprintf(stderr, FL "Writing LZ78 stream on encoder without symbol range\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const range = that -> input_symbol_max - that -> input_symbol_min + 1;
+	int const literal_bits = bitstream_bit_length(range - 1);
+	bitstream_reserve(stream, lz78encoder_cost_bits(that));
+	bitstream_write_gamma(stream, that -> input_symbol_count + 1);
+	bitstream_write_gamma(stream, range);
+	bitstream_write_gamma(stream, bitstream_zigzag(that -> input_symbol_min) + 1);
+	bitstream_write_gamma(stream, that -> bound.max_entries + 1);
+	if (that -> bound.max_entries) {
+		bitstream_write_truncated(stream, that -> bound.policy, LZ78_POLICIES);
+	}
+	for (long t = 0; t < that -> tokens.num_nodes; t++) {
+		bitstream_write_truncated(stream, lz78_node_index(that -> tokens.nodes[t]), that -> tokens.ranges[t]);
+		if (t < that -> tokens.num_symbols) {
+			bitstream_write_value(stream, that -> tokens.symbols[t] - that -> input_symbol_min, literal_bits);
+		}
+	}
 }
 
-lz78trie* lz78encoder_construct_trie(lz78encoder *const that) {
-	lz78trie* ret = calloc(1, sizeof(lz78trie) + (that -> input_symbol_max - that -> input_symbol_min) * sizeof(lz78trie*));
+/* Exact size of lz78encoder_write, from the tokens alone */
+size_t lz78encoder_cost_bits(lz78encoder *const that) {
+	if (that -> input_symbol_min > that -> input_symbol_max) {
+		fprintf(stderr, FL "Computing LZ78 cost on encoder without symbol range\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	long const range = that -> input_symbol_max - that -> input_symbol_min + 1;
+	size_t bits = bitstream_gamma_bits(that -> input_symbol_count + 1)
+				+ bitstream_gamma_bits(range)
+				+ bitstream_gamma_bits(bitstream_zigzag(that -> input_symbol_min) + 1)
+				+ bitstream_gamma_bits(that -> bound.max_entries + 1);
+	if (that -> bound.max_entries) {
+		bits += bitstream_truncated_bits(that -> bound.policy, LZ78_POLICIES);
+	}
+	for (long t = 0; t < that -> tokens.num_nodes; t++) {
+		bits += bitstream_truncated_bits(lz78_node_index(that -> tokens.nodes[t]), that -> tokens.ranges[t]);
+	}
+	bits += that -> tokens.num_symbols * bitstream_bit_length(range - 1);
+	return bits;
+}
+
+static long* lz78_decode_alloc(long const count) {
+	long *const ret = calloc(count, sizeof(long));
+	if (!ret) {
+		fprintf(stderr, FL "Can't allocate LZ78 decoder (%ld times %zu bytes)\n", count, sizeof(long));
+		exit(EXIT_MEMORY);
+	}
 	return ret;
 }
+
+/*
+ * The decoder replays the encoder's dictionary updates on an encoder
+ * trie, so that bounded dictionaries evict and reuse the same nodes on
+ * both sides. Each node also gets its parent, last symbol and length,
+ * to copy its string out.
+ */
+long* lz78_decode(bitstream *const stream, long *const symbol_count) {
+	long const count = bitstream_read_gamma(stream) - 1;
+	long const range = bitstream_read_gamma(stream);
+	long const offset = bitstream_read_gamma(stream) - 1;
+	long const max_entries = bitstream_read_gamma(stream) - 1;
+	if (count < 0 || range < 1 || offset < 0 || max_entries < 0 || max_entries >= UINT32_MAX) {
+		fprintf(stderr, "Invalid LZ78 header\n");
+		exit(EXIT_BADFILE);
+	}
+	lz78encoder *const dictionary = lz78encoder_construct();
+	if (max_entries) {
+		long const policy = bitstream_read_truncated(stream, LZ78_POLICIES);
+		if (policy < 0) {
+			fprintf(stderr, "Invalid LZ78 header\n");
+			exit(EXIT_BADFILE);
+		}
+		lz78encoder_set_max_entries(dictionary, max_entries, policy);
+	}
+	dictionary -> input_symbol_min = bitstream_unzigzag(offset);
+	dictionary -> input_symbol_max = dictionary -> input_symbol_min + range - 1;
+	lz78_start_dictionary(dictionary);
+
+	long const nodes = (max_entries && max_entries < count ? max_entries : count) + 1;
+	long *const parents = lz78_decode_alloc(nodes);
+	long *const values = lz78_decode_alloc(nodes);
+	long *const lengths = lz78_decode_alloc(nodes);
+	long *const symbols = lz78_decode_alloc(count + 1);
+	int const literal_bits = bitstream_bit_length(range - 1);
+	long position = 0;
+	while (position < count) {
+		long const node = bitstream_read_truncated(stream, dictionary -> trie.nodes);
+		if (node < 0 || lengths[node] > count - position) {
+			fprintf(stderr, "Invalid LZ78 node at symbol %ld\n", position);
+			exit(EXIT_BADFILE);
+		}
+		long const length = lengths[node];
+		long copy = node;
+		for (long i = length - 1; i >= 0; i--) {
+			symbols[position + i] = values[copy];
+			copy = parents[copy];
+		}
+		position += length;
+		if (position == count) {
+			break;
+		}
+		long const literal = bitstream_read_value(stream, literal_bits);
+		if (literal < 0 || literal >= range) {
+			fprintf(stderr, "Invalid LZ78 literal at symbol %ld\n", position);
+			exit(EXIT_BADFILE);
+		}
+		symbols[position++] = literal + dictionary -> input_symbol_min;
+		long const added = lz78_add_entry(dictionary, node, literal);
+		if (added) {
+			parents[added] = node;
+			values[added] = literal + dictionary -> input_symbol_min;
+			lengths[added] = length + 1;
+		}
+	}
+	free(parents);
+	free(values);
+	free(lengths);
+	lz78encoder_destruct(dictionary);
+	*symbol_count = count;
+	return symbols;
+}
+
+/* Dense nodes are carved out of one array that grows geometrically, up to the bound */
+long lz78encoder_add_node(lz78encoder *const that) {
+	lz78trie *const trie = &that -> trie;
+	if (trie -> nodes >= UINT32_MAX) {
+		fprintf(stderr, FL "LZ78 trie too large (%ld nodes)\n", trie -> nodes);
+		exit(EXIT_MEMORY);
+	}
+	if (trie -> width > LZ78_DENSE_WIDTH) {
+		return trie -> nodes++;
+	}
+	if (trie -> nodes == trie -> allocated) {
+		long allocated = trie -> allocated ? 2 * trie -> allocated : LZ78_INITIAL_NODES;
+		if (that -> bound.max_entries && allocated > that -> bound.max_entries + 1) {
+			allocated = that -> bound.max_entries + 1;
+		}
+		trie -> children = realloc(trie -> children, allocated * trie -> width * sizeof(uint32_t));
+		if (!trie -> children) {
+			fprintf(stderr, FL "Can't allocate LZ78 trie (%ld nodes of %ld children)\n",
+						allocated,
+						trie -> width);
+			exit(EXIT_MEMORY);
+		}
+		memset(trie -> children + trie -> allocated * trie -> width,
+					0,
+					(allocated - trie -> allocated) * trie -> width * sizeof(uint32_t));
+		trie -> allocated = allocated;
+	}
+	return trie -> nodes++;
+}
+
+static unsigned long lz78_hash(long const node, long const symbol) {
+	unsigned long const key = ((unsigned long)node << 32) ^ (unsigned long)symbol;
+	return (key * 0x9E3779B97F4A7C15UL) >> 17;
+}
+
+/* Slot of (node, symbol) in the hash table, or of the empty slot where it would go */
+static long lz78_hash_find(lz78trie const *const trie, long const node, long const symbol) {
+	long const mask = trie -> hash_slots - 1;
+	long slot = lz78_hash(node, symbol) & mask;
+	while (trie -> hash[slot].child
+				&& (trie -> hash[slot].parent != node || trie -> hash[slot].symbol != symbol)) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static void lz78_hash_grow(lz78trie *const trie) {
+	lz78hashentry *const old = trie -> hash;
+	long const old_slots = trie -> hash_slots;
+	trie -> hash_slots = old_slots ? 2 * old_slots : LZ78_INITIAL_HASH_SLOTS;
+	trie -> hash = calloc(trie -> hash_slots, sizeof(lz78hashentry));
+	if (!trie -> hash) {
+		fprintf(stderr, FL "Can't allocate LZ78 hash table (%ld times %zu bytes)\n",
+					trie -> hash_slots,
+					sizeof(lz78hashentry));
+		exit(EXIT_MEMORY);
+	}
+	for (long i = 0; i < old_slots; i++) {
+		if (old[i].child) {
+			trie -> hash[lz78_hash_find(trie, old[i].parent, old[i].symbol)] = old[i];
+		}
+	}
+	free(old);
+}
+
+long lz78encoder_child(lz78encoder const *const that, long const node, long const symbol) {
+	lz78trie const *const trie = &that -> trie;
+	if (trie -> width <= LZ78_DENSE_WIDTH) {
+		return trie -> children[node * trie -> width + symbol];
+	}
+	if (!trie -> hash) {
+		return 0;
+	}
+	return trie -> hash[lz78_hash_find(trie, node, symbol)].child;
+}
+
+void lz78encoder_set_child(lz78encoder *const that, long const node, long const symbol, long const child) {
+	lz78trie *const trie = &that -> trie;
+	if (trie -> width <= LZ78_DENSE_WIDTH) {
+		trie -> children[node * trie -> width + symbol] = child;
+		return;
+	}
+	if (2 * (trie -> hash_used + 1) > trie -> hash_slots) {
+		lz78_hash_grow(trie);
+	}
+	lz78hashentry *const entry = trie -> hash + lz78_hash_find(trie, node, symbol);
+	if (!entry -> child) {
+		trie -> hash_used++;
+	}
+	entry -> parent = node;
+	entry -> symbol = symbol;
+	entry -> child = child;
+}
+
+/* Linear probing deletion, shifting back later entries of the same run */
+void lz78encoder_remove_child(lz78encoder *const that, long const node, long const symbol) {
+	lz78trie *const trie = &that -> trie;
+	if (trie -> width <= LZ78_DENSE_WIDTH) {
+		trie -> children[node * trie -> width + symbol] = 0;
+		return;
+	}
+	long const mask = trie -> hash_slots - 1;
+	long hole = lz78_hash_find(trie, node, symbol);
+	if (!trie -> hash[hole].child) {
+		return;
+	}
+	trie -> hash_used--;
+	for (long slot = (hole + 1) & mask; trie -> hash[slot].child; slot = (slot + 1) & mask) {
+		long const home = lz78_hash(trie -> hash[slot].parent, trie -> hash[slot].symbol) & mask;
+		if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+			trie -> hash[hole] = trie -> hash[slot];
+			hole = slot;
+		}
+	}
+	trie -> hash[hole].child = 0;
+}
@@ -25,21 +25,59 @@
 #define LZ78_H_INCLUDED
 
 #include "bitstream.h"
+#include "symbol_stats.h"
 
 typedef struct lz78encoder lz78encoder;
 
+/*
+ * What to do when a bounded dictionary is full. Only leaves can be
+ * evicted, since every entry is a prefix of its children.
+ */
+enum lz78_policy {
+    LZ78_FULL_STOP = 0,      /* stop adding entries (LZW) */
+    LZ78_FULL_CLEAR,         /* clear the whole dictionary (LZC) */
+    LZ78_FULL_EVICT_LRU,     /* evict the least recently used entry (LZT) */
+    LZ78_FULL_EVICT_LEAF,    /* evict the oldest unreferenced entry (BTLZ) */
+    LZ78_FULL_EVICT_LEAVES,  /* evict all unreferenced entries (LZJ) */
+};
+
 lz78encoder* lz78encoder_construct();
 
 void lz78encoder_destruct(lz78encoder *const that);
 
+/* Bound the dictionary to max_entries besides the root (0 for no bound), before matching */
+void lz78encoder_set_max_entries(
+    lz78encoder *const that,
+    long const max_entries,
+    enum lz78_policy const policy);
+
 void lz78encoder_compute_symbol_range(
     lz78encoder *const that,
     long const *const symbols,
     long const symbol_count);
 
+void lz78encoder_import_stats(
+    lz78encoder *const that,
+    symbol_stats const *const stats);
+
 void lz78encoder_find_matches(
     lz78encoder *const that,
     long const *const symbols,
     long const symbol_count);
 
+long lz78encoder_token_count(lz78encoder const *const that);
+
+long const* lz78encoder_token_nodes(lz78encoder const *const that);
+
+long lz78encoder_literal_count(lz78encoder const *const that);
+
+long const* lz78encoder_token_symbols(lz78encoder const *const that);
+
+void lz78encoder_write(lz78encoder *const that, bitstream *const stream);
+
+size_t lz78encoder_cost_bits(lz78encoder *const that);
+
+/* Decode a stream written by lz78encoder_write, into a buffer of symbol_count symbols to free */
+long* lz78_decode(bitstream *const stream, long *const symbol_count);
+
 #endif /* LZ78_H_INCLUDED */
@@ -22,22 +22,107 @@
 
 #include "lz78.h"
 
+#include <stdint.h>
+
+/* Trie nodes allocated up front, the array doubles from there */
+#define LZ78_INITIAL_NODES 1024
+
+/* Widest symbol range for which nodes keep one child index per symbol */
+#define LZ78_DENSE_WIDTH 256
+
+/* Initial size of the hashed child table, a power of 2 */
+#define LZ78_INITIAL_HASH_SLOTS 4096
+
+/* Child of a node in the hashed child table, child 0 is an empty slot */
+typedef struct lz78hashentry {
+    long symbol;
+    uint32_t parent;
+    uint32_t child;
+} lz78hashentry;
+
+/*
+ * Dictionary trie. The root is node 0, which is never a child, and node
+ * i > 0 has node id i + 2.
+ *
+ * With narrow symbol ranges, all nodes are in one array, node i having
+ * one child index per symbol at children[i * width], 0 for no child.
+ * With wider ranges, children are in one open-addressing hash table
+ * keyed by (parent, symbol), with linear probing, kept at most half full.
+ */
+typedef struct lz78trie {
+    uint32_t* children;
+    long width;
+    long nodes;
+    long allocated;
+    lz78hashentry* hash;
+    long hash_slots;
+    long hash_used;
+} lz78trie;
+
+/* Number of values in enum lz78_policy */
+#define LZ78_POLICIES 5
+
+/*
+ * Bookkeeping for a bounded dictionary, one entry per trie node, node 0
+ * being the root. The root is never in a list, so 0 also ends lists.
+ * With LRU eviction, prev/next link all entries from most to least
+ * recently used, every entry ahead of its children, so that the tail is
+ * always a leaf. With leaf eviction, they link only the leaves, from
+ * newest to oldest. Nodes freed by evictions are chained through next.
+ */
+typedef struct lz78bound {
+    long max_entries;
+    enum lz78_policy policy;
+    long entries;
+    uint32_t* parents;
+    long* symbols;
+    uint32_t* child_counts;
+    uint32_t* prev;
+    uint32_t* next;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t free;
+} lz78bound;
+
+/* Token capacity reserved up front, per input symbol */
+#define LZ78_TOKENS_PER_SYMBOL_DIVISOR 4
+
+/* Token capacity reserved up front, on top of the above */
+#define LZ78_TOKENS_EXTRA 64
+
+/*
+ * Tokens as parallel arrays. Every token has a node, chosen among the
+ * number of trie nodes in ranges, all but possibly the last one have a
+ * symbol. Capacity doubles when full.
+ */
+typedef struct lz78tokens {
+    long* nodes;
+    long* ranges;
+    long* symbols;
+    long num_nodes;
+    long num_symbols;
+    long allocated;
+} lz78tokens;
+
 struct lz78encoder {
     long input_symbol_min;
     long input_symbol_max;
-    long stream_num_nodes;
-    long stream_num_symbols;
-    long* stream_nodes;
-    long* stream_symbols;
+    long input_symbol_count;
+    lz78tokens tokens;
+    lz78trie trie;
+    lz78bound bound;
 };
 
+void lz78encoder_output_node(lz78encoder* const that, long const node_id);
+
 void lz78encoder_output_entry(lz78encoder* const that, long const node_id, long const symbol);
 
-typedef struct lz78trie {
-    long node_id;
-    struct lz78trie* next_level[1];
-} lz78trie;
+long lz78encoder_add_node(lz78encoder *const that);
+
+long lz78encoder_child(lz78encoder const *const that, long const node, long const symbol);
+
+void lz78encoder_set_child(lz78encoder *const that, long const node, long const symbol, long const child);
 
-lz78trie* lz78encoder_construct_trie(lz78encoder *const that);
+void lz78encoder_remove_child(lz78encoder *const that, long const node, long const symbol);
 
 #endif /* LZ78_INTERNAL_H_INCLUDED */
@@ -93,6 +93,7 @@ struct image* pi1_read(char* filename) {
 	}
 	memset(ret -> pixels, 0, 64000);
 
+	int const trace = TRACE_ENABLED(VERB_EXTRA);
 	for (int y = 0; y < 200; y++) {
 		for (int x = 0; x < 320; x++) {
 			for (int b = 0; b < 4; b++) {
@@ -100,10 +101,8 @@ struct image* pi1_read(char* filename) {
 					ret -> pixels[x + 320 * y] |= (1 << b);
 				}
 			}
-			if (verbosity >= VERB_EXTRA) {
-				if (!ret -> color_used[ret -> pixels[x + 320 * y]]) {
-					printf("Found pixel with color %d\n", ret -> pixels[x + 320 * y]);
-				}
+			if (trace && !ret -> color_used[ret -> pixels[x + 320 * y]]) {
+				TRACE("Found pixel with color %d\n", ret -> pixels[x + 320 * y]);
 			}
 			ret -> color_used[ret -> pixels[x + 320 * y]] = 1;
 		}
@@ -25,6 +25,7 @@
 #include "huffman.h"
 #include "image.h"
 #include "lz78.h"
+#include "symbol_stats.h"
 
 #include "other_formats/degas.h"
 
@@ -82,18 +83,21 @@ int main(int argc, char** argv) {
 
 	image_destruct(img);
 
+/*
+	symbol_stats* stats = symbol_stats_construct();
+	symbol_stats_compute(stats, pixels, 64000);
+*/
+
 /*
 	lz78encoder* lz78 = lz78encoder_construct();
-	lz78encoder_compute_symbol_range(lz78, pixels, 64000);
+	lz78encoder_import_stats(lz78, stats);
 	lz78encoder_find_matches(lz78, pixels, 64000);
 	lz78encoder_destruct(lz78);
 */
 
 /*
 	huffman* h = huffman_construct();
-	huffman_compute_symbol_range(h, pixels, 64000);
-	huffman_compute_symbol_counts(h, pixels, 64000);
-	huffman_count_symbols_present(h);
+	huffman_import_stats(h, stats);
 	huffman_build_tree(h);
 	huffman_build_codes(h);
 
@@ -107,6 +111,7 @@ int main(int argc, char** argv) {
 	huffman_destruct(h);
 */
 /*
+	symbol_stats_destruct(stats);
 	free(pixels);
 */
 	return EXIT_SUCCESS;
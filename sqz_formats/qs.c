@@ -56,6 +56,17 @@ struct image* qs1_read(bitstream *const stream) {
 	return ret;
 }
 
+/* 16-bit color mask, 9 bits per stored color, 4 bits per pixel */
+size_t qs1_cost_bits(struct image const *const img) {
+	int colors = 0;
+	for (int c = 0; c < 16; c++) {
+		if (c == 0 || img -> color_used[c]) {
+			colors++;
+		}
+	}
+	return 16 + 9 * colors + 4 * 64000;
+}
+
 void qs1_write(struct image const *const img, bitstream *const stream) {
 	if (img -> width != 320 || img -> height != 200 || img -> bpp != 4) {
 		fprintf(stderr, "Error, QS1 files must be 320*200*4bpp\n");
@@ -71,6 +82,7 @@ void qs1_write(struct image const *const img, bitstream *const stream) {
 	if (img -> separate_border) {
 		printf("ignoring border color for QS1 image\n");
 	}
+	bitstream_reserve(stream, qs1_cost_bits(img));
 	for (int c = 0; c < 16; c++) {
 		bitstream_write_bit(stream, img -> color_used[c] != 0);
 	}
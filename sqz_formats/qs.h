@@ -25,6 +25,8 @@
 
 struct image* qs1_read(bitstream *const stream);
 
+size_t qs1_cost_bits(struct image const *const img);
+
 void qs1_write(struct image const *const img, bitstream *const stream);
 
 #endif /* SQZQS_H_INCLUDED */
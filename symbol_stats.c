@@ -0,0 +1,301 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "symbol_stats_internal.h"
+
+#include "debug.h"
+#include "exitcodes.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+symbol_stats* symbol_stats_construct() {
+	symbol_stats* that = calloc(1, sizeof(symbol_stats));
+	if (!that) {
+		fprintf(stderr, FL "Can't allocate symbol_stats structure (%zu bytes)\n", sizeof (symbol_stats));
+		exit(EXIT_MEMORY);
+	}
+	that -> symbol_min = LONG_MAX;
+	that -> symbol_max = LONG_MIN;
+	return that;
+}
+
+void symbol_stats_destruct(symbol_stats *const that) {
+	if (that) {
+		free(that -> counts);
+		free(that -> values);
+	}
+	free(that);
+}
+
+static int symbol_stats_bucket(long length) {
+	int bucket = -1;
+	while (length) {
+		bucket++;
+		length >>= 1;
+	}
+	return bucket;
+}
+
+/* Range and runs only need to look at each symbol and its predecessor */
+static void symbol_stats_scan_range(symbol_stats *const that,
+			long const *const symbols,
+			long const symbol_count) {
+	long symbol_min = LONG_MAX;
+	long symbol_max = LONG_MIN;
+	long run = 1;
+	for (long i = 0; i < symbol_count; i++) {
+		if (symbols[i] < symbol_min) {
+			symbol_min = symbols[i];
+		}
+		if (symbols[i] > symbol_max) {
+			symbol_max = symbols[i];
+		}
+		if (i + 1 < symbol_count && symbols[i + 1] == symbols[i]) {
+			run++;
+		} else {
+			that -> runs[symbol_stats_bucket(run)]++;
+			run = 1;
+		}
+	}
+	that -> symbol_min = symbol_min;
+	that -> symbol_max = symbol_max;
+}
+
+static void symbol_stats_allocate_counts(symbol_stats *const that, long const slots) {
+	that -> counts = calloc(slots, sizeof(long));
+	if (!that -> counts) {
+		fprintf(stderr, FL "Can't allocate symbol counts (%ld times %zu bytes)\n",
+					slots,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	that -> slots = slots;
+}
+
+/*
+ * Consecutive symbols go to different histograms, so that a run of the
+ * same symbol doesn't make each increment wait for the previous store.
+ */
+static void symbol_stats_count_dense(symbol_stats *const that,
+			long const *const symbols,
+			long const symbol_count) {
+	long const range = that -> symbol_max - that -> symbol_min + 1;
+	long *const histograms = calloc(SYMBOL_STATS_HISTOGRAMS * range, sizeof(long));
+	if (!histograms) {
+		fprintf(stderr, FL "Can't allocate symbol histograms (%ld times %zu bytes)\n",
+					SYMBOL_STATS_HISTOGRAMS * range,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	long const symbol_min = that -> symbol_min;
+	long *const h0 = histograms;
+	long *const h1 = h0 + range;
+	long *const h2 = h1 + range;
+	long *const h3 = h2 + range;
+	long i = 0;
+	for (; i + SYMBOL_STATS_HISTOGRAMS <= symbol_count; i += SYMBOL_STATS_HISTOGRAMS) {
+		h0[symbols[i] - symbol_min]++;
+		h1[symbols[i + 1] - symbol_min]++;
+		h2[symbols[i + 2] - symbol_min]++;
+		h3[symbols[i + 3] - symbol_min]++;
+	}
+	for (; i < symbol_count; i++) {
+		h0[symbols[i] - symbol_min]++;
+	}
+
+	symbol_stats_allocate_counts(that, range);
+	for (long slot = 0; slot < range; slot++) {
+		that -> counts[slot] = histograms[slot]
+					+ histograms[range + slot]
+					+ histograms[2 * range + slot]
+					+ histograms[3 * range + slot];
+	}
+	free(histograms);
+}
+
+static int symbol_stats_compare_values(void const *const a, void const *const b) {
+	long const va = *(long const*)a;
+	long const vb = *(long const*)b;
+	return (va > vb) - (va < vb);
+}
+
+int symbol_stats_dense(long const symbol_min, long const symbol_max, long const distinct) {
+	unsigned long const span = (unsigned long)symbol_max - (unsigned long)symbol_min;
+	if (span == ULONG_MAX) {
+		return 0;
+	}
+	return span + 1 <= SYMBOL_STATS_DENSE_RANGE || (span + 1) / SYMBOL_STATS_SPARSE_RATIO <= (unsigned long)distinct;
+}
+
+/*
+ * Wide ranges are counted from a sorted copy. Only the values present get
+ * a slot unless they fill enough of the range, so that memory doesn't
+ * grow with the range.
+ */
+static void symbol_stats_count_sorted(symbol_stats *const that,
+			long const *const symbols,
+			long const symbol_count) {
+	long *const sorted = malloc(symbol_count * sizeof(long));
+	if (!sorted) {
+		fprintf(stderr, FL "Can't allocate sorted symbols (%ld times %zu bytes)\n",
+					symbol_count,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	memcpy(sorted, symbols, symbol_count * sizeof(long));
+	qsort(sorted, symbol_count, sizeof(long), symbol_stats_compare_values);
+	long distinct = 0;
+	for (long i = 0; i < symbol_count; i++) {
+		if (i == 0 || sorted[i] != sorted[i - 1]) {
+			sorted[distinct++] = sorted[i];
+		}
+	}
+	if (symbol_stats_dense(that -> symbol_min, that -> symbol_max, distinct)) {
+		free(sorted);
+		symbol_stats_allocate_counts(that, that -> symbol_max - that -> symbol_min + 1);
+		for (long i = 0; i < symbol_count; i++) {
+			that -> counts[symbols[i] - that -> symbol_min]++;
+		}
+		return;
+	}
+	symbol_stats_allocate_counts(that, distinct);
+	that -> values = realloc(sorted, distinct * sizeof(long));
+	if (!that -> values) {
+		fprintf(stderr, FL "Can't allocate symbol values (%ld times %zu bytes)\n",
+					distinct,
+					sizeof(long));
+		exit(EXIT_MEMORY);
+	}
+	for (long i = 0; i < symbol_count; i++) {
+		that -> counts[symbol_stats_slot(that, symbols[i])]++;
+	}
+}
+
+/*
+ * One pass finds the range and the runs, which decide how the histogram
+ * is stored, and a second pass fills the histogram. Distinct count and
+ * entropy come from the histogram without looking at the symbols again.
+ */
+void symbol_stats_compute(symbol_stats *const that,
+			long const *const symbols,
+			long const symbol_count) {
+	if (!that) {
+		fprintf(stderr, FL "Computing symbol statistics on NULL object\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (that -> counts) {
+		fprintf(stderr, FL "Computing symbol statistics a second time\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	if (symbol_count <= 0) {
+		fprintf(stderr, FL "Computing symbol statistics without symbols\n");
+		exit(EXIT_INVALIDSTATE);
+	}
+	that -> symbol_count = symbol_count;
+	symbol_stats_scan_range(that, symbols, symbol_count);
+	if (symbol_stats_dense(that -> symbol_min, that -> symbol_max, 0)) {
+		symbol_stats_count_dense(that, symbols, symbol_count);
+	} else {
+		symbol_stats_count_sorted(that, symbols, symbol_count);
+	}
+
+	for (long slot = 0; slot < that -> slots; slot++) {
+		long const count = that -> counts[slot];
+		if (count) {
+			that -> distinct++;
+			that -> entropy_bits += count * log2((double)symbol_count / count);
+		}
+	}
+
+	if (verbosity >= VERB_EXTRA) {
+		printf("Symbol range: %ld-%ld\n", that -> symbol_min, that -> symbol_max);
+		printf("Symbol counts in %ld %s slots, %ld distinct\n",
+					that -> slots,
+					that -> values ? "sparse" : "dense",
+					that -> distinct);
+		for (int bucket = 0; bucket < SYMBOL_STATS_RUN_BUCKETS; bucket++) {
+			if (that -> runs[bucket]) {
+				printf("Symbol runs of %ld+: %ld\n", 1L << bucket, that -> runs[bucket]);
+			}
+		}
+		printf("Symbol order-0 entropy: %.0f bits\n", that -> entropy_bits);
+	}
+}
+
+long symbol_stats_slot(symbol_stats const *const that, long const value) {
+	return symbol_stats_find_slot(that -> values, that -> slots, that -> symbol_min, that -> symbol_max, value);
+}
+
+long symbol_stats_find_slot(long const *const values,
+			long const slots,
+			long const symbol_min,
+			long const symbol_max,
+			long const value) {
+	if (value < symbol_min || value > symbol_max) {
+		return -1;
+	}
+	if (!values) {
+		return value - symbol_min;
+	}
+	long low = 0;
+	long high = slots - 1;
+	while (low <= high) {
+		long const middle = low + (high - low) / 2;
+		if (values[middle] < value) {
+			low = middle + 1;
+		} else if (values[middle] > value) {
+			high = middle - 1;
+		} else {
+			return middle;
+		}
+	}
+	return -1;
+}
+
+long symbol_stats_min(symbol_stats const *const that) {
+	return that -> symbol_min;
+}
+
+long symbol_stats_max(symbol_stats const *const that) {
+	return that -> symbol_max;
+}
+
+long symbol_stats_distinct(symbol_stats const *const that) {
+	return that -> distinct;
+}
+
+long symbol_stats_count(symbol_stats const *const that, long const value) {
+	long const slot = symbol_stats_slot(that, value);
+	return slot < 0 ? 0 : that -> counts[slot];
+}
+
+long symbol_stats_runs(symbol_stats const *const that, int const bucket) {
+	if (bucket < 0 || bucket >= SYMBOL_STATS_RUN_BUCKETS) {
+		return 0;
+	}
+	return that -> runs[bucket];
+}
+
+double symbol_stats_entropy_bits(symbol_stats const *const that) {
+	return that -> entropy_bits;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+/*
+ * Definitions for symbol statistics shared between coding stages
+ */
+
+#ifndef SYMBOL_STATS_H_INCLUDED
+#define SYMBOL_STATS_H_INCLUDED
+
+typedef struct symbol_stats symbol_stats;
+
+/* Construct a statistics object */
+symbol_stats* symbol_stats_construct();
+
+/* Destruct a statistics object */
+void symbol_stats_destruct(symbol_stats *const that);
+
+/* Compute all statistics of a symbol buffer */
+void symbol_stats_compute(symbol_stats *const that,
+			long const *const symbols,
+			long const symbol_count);
+
+/* Smallest symbol */
+long symbol_stats_min(symbol_stats const *const that);
+
+/* Largest symbol */
+long symbol_stats_max(symbol_stats const *const that);
+
+/* Number of distinct symbols */
+long symbol_stats_distinct(symbol_stats const *const that);
+
+/* Number of instances of a symbol */
+long symbol_stats_count(symbol_stats const *const that, long const value);
+
+/* Number of runs of identical symbols with lengths from 2^bucket to 2^(bucket+1)-1 */
+long symbol_stats_runs(symbol_stats const *const that, int const bucket);
+
+/* Order-0 entropy of the whole buffer, in bits */
+double symbol_stats_entropy_bits(symbol_stats const *const that);
+
+#endif /* SYMBOL_STATS_H_INCLUDED */
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#ifndef SYMBOL_STATS_INTERNAL_H_INCLUDED
+#define SYMBOL_STATS_INTERNAL_H_INCLUDED
+
+#include "symbol_stats.h"
+
+/* Symbol ranges up to this size are always counted in one slot per value */
+#define SYMBOL_STATS_DENSE_RANGE 256
+
+/* Wider ranges are counted in one slot per value when at least 1 value in this many is present */
+#define SYMBOL_STATS_SPARSE_RATIO 4
+
+/* Interleaved histograms, so that repeated symbols don't wait on each other */
+#define SYMBOL_STATS_HISTOGRAMS 4
+
+/* Run length buckets, one per power of 2 */
+#define SYMBOL_STATS_RUN_BUCKETS 64
+
+/*
+ * Counts are stored in slots. Dense statistics have one slot per value
+ * in the symbol range, sparse ones have one slot per distinct value,
+ * with the values sorted in values.
+ */
+struct symbol_stats {
+	long symbol_count;
+	long symbol_min;
+	long symbol_max;
+	long slots;
+	long* counts;
+	long* values;
+	long distinct;
+	long runs[SYMBOL_STATS_RUN_BUCKETS];
+	double entropy_bits;
+};
+
+/* Slot holding a symbol value, -1 if the value has no slot */
+long symbol_stats_slot(symbol_stats const *const that, long const value);
+
+/* Whether symbols from min to max with distinct values present get one slot per value */
+int symbol_stats_dense(long const symbol_min, long const symbol_max, long const distinct);
+
+/* Slot of a value in dense slots from symbol_min, or among sorted values when not NULL, -1 if absent */
+long symbol_stats_find_slot(long const *const values,
+			long const slots,
+			long const symbol_min,
+			long const symbol_max,
+			long const value);
+
+#endif /* SYMBOL_STATS_INTERNAL_H_INCLUDED */
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "../bitstream_internal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Each benchmark processes one QS1 image worth of pixels (64000 values)
+ * per round, for enough rounds to get stable timings.
+ */
+static const int values_per_round = 64000;
+static const int rounds = 200;
+
+static int* widths;
+static long* values;
+static long checksum;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(char const *const name, double const seconds, long const ops, long const bits, long const allocations) {
+	printf("%-28s %8.2f ns/op %10.1f Mbit/s %8ld allocations\n",
+			name,
+			seconds * 1e9 / ops,
+			bits / seconds * 1e-6,
+			allocations);
+}
+
+/* Fill a stream with the widths and values of the random-width benchmark */
+static bitstream* prepare_random() {
+	bitstream* bs = bitstream_construct();
+	for (int i = 0; i < values_per_round; i++) {
+		bitstream_write_value(bs, values[i], widths[i]);
+	}
+	return bs;
+}
+
+static void bench_write_random() {
+	long const allocations = bitstream_allocation_count;
+	long bits = 0;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bitstream* bs = bitstream_construct();
+		for (int i = 0; i < values_per_round; i++) {
+			bitstream_write_value(bs, values[i], widths[i]);
+		}
+		bits += bitstream_bit_size(bs);
+		bitstream_destruct(bs);
+	}
+	report("write random widths", now() - start, (long)rounds * values_per_round, bits,
+			bitstream_allocation_count - allocations);
+}
+
+static void bench_write_4bits(int const per_bit) {
+	long const allocations = bitstream_allocation_count;
+	long bits = 0;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bitstream* bs = bitstream_construct();
+		for (int i = 0; i < values_per_round; i++) {
+			if (per_bit) {
+				for (int b = 3; b >= 0; b--) {
+					bitstream_write_bit(bs, (values[i] >> b) & 1);
+				}
+			} else {
+				bitstream_write_value(bs, values[i], 4);
+			}
+		}
+		bits += bitstream_bit_size(bs);
+		bitstream_destruct(bs);
+	}
+	report(per_bit ? "write 4 bits (per-bit)" : "write 4 bits", now() - start,
+			(long)rounds * values_per_round, bits,
+			bitstream_allocation_count - allocations);
+}
+
+static void bench_write_4bits_reserved() {
+	long const allocations = bitstream_allocation_count;
+	long bits = 0;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bitstream* bs = bitstream_construct();
+		bitstream_reserve(bs, 4 * values_per_round);
+		for (int i = 0; i < values_per_round; i++) {
+			bitstream_write_value(bs, values[i], 4);
+		}
+		bits += bitstream_bit_size(bs);
+		bitstream_destruct(bs);
+	}
+	report("write 4 bits (reserved)", now() - start, (long)rounds * values_per_round, bits,
+			bitstream_allocation_count - allocations);
+}
+
+static void bench_read_4bits(int const per_bit) {
+	bitstream* bs = bitstream_construct();
+	for (int i = 0; i < values_per_round; i++) {
+		bitstream_write_value(bs, values[i], 4);
+	}
+	long const allocations = bitstream_allocation_count;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bs -> current = 0;
+		for (int i = 0; i < values_per_round; i++) {
+			if (per_bit) {
+				long value = 0;
+				for (int b = 0; b < 4; b++) {
+					value = (value << 1) | bitstream_read_bit(bs);
+				}
+				checksum += value;
+			} else {
+				checksum += bitstream_read_value(bs, 4);
+			}
+		}
+	}
+	report(per_bit ? "read 4 bits (per-bit)" : "read 4 bits", now() - start,
+			(long)rounds * values_per_round, (long)rounds * bitstream_bit_size(bs),
+			bitstream_allocation_count - allocations);
+	bitstream_destruct(bs);
+}
+
+static void bench_read_random() {
+	bitstream* bs = prepare_random();
+	long const allocations = bitstream_allocation_count;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bs -> current = 0;
+		for (int i = 0; i < values_per_round; i++) {
+			checksum += bitstream_read_value(bs, widths[i]);
+		}
+	}
+	report("read random widths", now() - start,
+			(long)rounds * values_per_round, (long)rounds * bitstream_bit_size(bs),
+			bitstream_allocation_count - allocations);
+	bitstream_destruct(bs);
+}
+
+static void bench_peek_skip() {
+	bitstream* bs = prepare_random();
+	long const allocations = bitstream_allocation_count;
+	double const start = now();
+	for (int r = 0; r < rounds; r++) {
+		bs -> current = 0;
+		for (int i = 0; i < values_per_round; i++) {
+			checksum += bitstream_peek(bs, 16);
+			bitstream_skip(bs, widths[i]);
+		}
+	}
+	report("peek 16 + skip random", now() - start,
+			(long)rounds * values_per_round, (long)rounds * bitstream_bit_size(bs),
+			bitstream_allocation_count - allocations);
+	bitstream_destruct(bs);
+}
+
+int main(int, char**) {
+	widths = malloc(values_per_round * sizeof (int));
+	values = malloc(values_per_round * sizeof (long));
+	if (!widths || !values) {
+		printf("can't allocate benchmark data\n");
+		return 1;
+	}
+	srand(1);
+	for (int i = 0; i < values_per_round; i++) {
+		widths[i] = 1 + rand() % 32;
+		values[i] = rand() & ((1L << widths[i]) - 1);
+	}
+
+	bench_write_random();
+	bench_write_4bits(0);
+	bench_write_4bits_reserved();
+	bench_write_4bits(1);
+	bench_read_random();
+	bench_read_4bits(0);
+	bench_read_4bits(1);
+	bench_peek_skip();
+
+	printf("(checksum %ld)\n", checksum);
+	free(widths);
+	free(values);
+	return 0;
+}
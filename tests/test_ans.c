@@ -0,0 +1,82 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "../ans.h"
+#include "../bitstream_internal.h"
+#include "../symbol_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int test_round_trip();
+
+int main(int, char**) {
+	return test_round_trip();
+}
+
+static unsigned long test_random_state = 1;
+
+static unsigned long test_random() {
+	test_random_state = test_random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return test_random_state >> 16;
+}
+
+/* Value written after the encoded symbols, to check that the decoder stops at the right bit */
+static long const test_trailer = 0x5a5;
+static int const test_trailer_bits = 12;
+
+/* Encode with computed or given statistics, decode and compare */
+int test_round_trip() {
+	int ret = 0;
+	test_random_state = 1;
+	for (int i = 0; i < 200 && !ret; i++) {
+		long const count = 1 + test_random() % 30000;
+		long const range = 1 + test_random() % (i % 5 ? 16 : 3000);
+		long const offset = (long)(test_random() % 100) - 50;
+		long *const symbols = malloc(count * sizeof(long));
+		for (long j = 0; j < count; j++) {
+			long const r = test_random() % range;
+			symbols[j] = offset + (test_random() % 4 ? r * r / range : r);
+		}
+		symbol_stats *const stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+
+		bitstream* bs = bitstream_construct();
+		ans_encode(symbols, count, i % 2 ? stats : NULL, bs);
+		bitstream_write_value(bs, test_trailer, test_trailer_bits);
+		bs -> current = 0;
+		long *const decoded = malloc(count * sizeof(long));
+		ans_decode(bs, decoded, count);
+		for (long j = 0; j < count && !ret; j++) {
+			if (decoded[j] != symbols[j]) {
+				printf("ANS symbol %ld of %ld decoded as %ld instead of %ld\n", j, count, decoded[j], symbols[j]);
+				ret = 1;
+			}
+		}
+		if (!ret && bitstream_read_value(bs, test_trailer_bits) != test_trailer) {
+			printf("ANS decoder didn't stop after the last symbol\n");
+			ret = 1;
+		}
+		free(decoded);
+		bitstream_destruct(bs);
+		symbol_stats_destruct(stats);
+		free(symbols);
+	}
+	return ret;
+}
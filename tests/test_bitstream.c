@@ -21,9 +21,18 @@
 
 #include <limits.h>
 #include <stdio.h>
+#include <string.h>
 
 int test_init_state();
 int test_write();
+int test_write_value();
+int test_read_value();
+int test_reserve();
+int test_file();
+int test_sink();
+int test_codes();
+int test_peek();
+int test_bytes();
 
 int main(int, char**) {
 	if (CHAR_BIT != 8) {
@@ -33,6 +42,14 @@ int main(int, char**) {
 	int ret = 0;
 	ret |= test_init_state();
 	ret |= test_write();
+	ret |= test_write_value();
+	ret |= test_read_value();
+	ret |= test_reserve();
+	ret |= test_file();
+	ret |= test_sink();
+	ret |= test_codes();
+	ret |= test_peek();
+	ret |= test_bytes();
 	return ret;
 }
 
@@ -305,3 +322,366 @@ int test_write() {
 	bitstream_destruct(bs);
 	return ret;
 }
+
+static unsigned long test_random_state = 1;
+
+static unsigned long test_random() {
+	test_random_state = test_random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return test_random_state >> 16;
+}
+
+int test_write_value() {
+	int ret = 0;
+	bitstream* words = bitstream_construct();
+	bitstream* bits = bitstream_construct();
+	test_random_state = 1;
+	for (int i = 0; i < 10000; i++) {
+		int numbits = test_random() % 64;
+		long value = (long)test_random();
+		bitstream_write_value(words, value, numbits);
+		for (int b = numbits - 1; b >= 0; b--) {
+			bitstream_write_bit(bits, (value >> b) & 1);
+		}
+	}
+	if (bitstream_bit_size(words) != bitstream_bit_size(bits)) {
+		printf("bit_size differs between value writes and bit writes\n");
+		ret = 1;
+	} else {
+		for (size_t i = 0; i < bitstream_bit_size(bits) / 8; i++) {
+			if (bitstream_byte_array(words)[i] != bitstream_byte_array(bits)[i]) {
+				printf("byte %zu differs between value writes and bit writes\n", i);
+				ret = 1;
+				break;
+			}
+		}
+	}
+	bitstream_destruct(words);
+	bitstream_destruct(bits);
+	return ret;
+}
+
+int test_read_value() {
+	int ret = 0;
+	bitstream* bs = bitstream_construct();
+	test_random_state = 2;
+	for (int i = 0; i < 10000; i++) {
+		int numbits = 1 + test_random() % 63;
+		bitstream_write_value(bs, (long)test_random(), numbits);
+	}
+	bs -> current = 0;
+	test_random_state = 2;
+	for (int i = 0; i < 10000; i++) {
+		int numbits = 1 + test_random() % 63;
+		long expected = (long)(test_random() & ((1UL << numbits) - 1));
+		long value = bitstream_read_value(bs, numbits);
+		if (value != expected) {
+			printf("value %d read back as %lx instead of %lx\n", i, value, expected);
+			ret = 1;
+			break;
+		}
+	}
+	if (bs -> current != bs -> size) {
+		printf("internal current after reading everything isn't size\n");
+		ret = 1;
+	}
+	if (bitstream_read_value(bs, 4) != -1) {
+		printf("reading past the end doesn't return -1\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+	return ret;
+}
+
+int test_reserve() {
+	int ret = 0;
+	bitstream* bs = bitstream_construct();
+	bitstream_write_value(bs, 0x5, 3);
+	bitstream_reserve(bs, 100000);
+	if (bs -> allocated < (3 + 100000 + 7) / 8) {
+		printf("allocated size too small after reserve\n");
+		ret = 1;
+	}
+	if (bs -> size != 3 || bs -> current != 3) {
+		printf("reserve changed the size or position\n");
+		ret = 1;
+	}
+	unsigned char const *const array = bs -> array;
+	for (int i = 0; i < 25000; i++) {
+		bitstream_write_value(bs, i, 4);
+	}
+	if (bs -> array != array) {
+		printf("storage reallocated while writing within reserved size\n");
+		ret = 1;
+	}
+	if (bitstream_byte_array(bs)[0] != 0xa0) {
+		printf("data written before reserve not preserved\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+	return ret;
+}
+
+int test_file() {
+	int ret = 0;
+	char const *const filename = "out/tmp/test_bitstream.bin";
+	bitstream* bs = bitstream_construct();
+	for (int i = 0; i < 1000; i++) {
+		bitstream_write_value(bs, i, 10);
+	}
+	bitstream_dump_to_file(bs, filename);
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct_from_file(filename);
+	if (bitstream_bit_size(bs) != 10000) {
+		printf("bit_size of file-backed stream isn't 10000\n");
+		ret = 1;
+	}
+	for (int i = 0; i < 1000; i++) {
+		if (bitstream_read_value(bs, 10) != i) {
+			printf("value %d not read back properly from file\n", i);
+			ret = 1;
+			break;
+		}
+	}
+	bitstream_write_value(bs, 0x3ff, 10);
+	if (bitstream_bit_size(bs) != 10010 || bitstream_byte_array(bs)[1250] != 0xff) {
+		printf("can't append to file-backed stream\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct();
+	bitstream_dump_to_file(bs, filename);
+	bitstream_destruct(bs);
+	bs = bitstream_construct_from_file(filename);
+	if (bitstream_bit_size(bs) != 0) {
+		printf("bit_size of empty file isn't zero\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+	remove(filename);
+	return ret;
+}
+
+int test_sink() {
+	int ret = 0;
+	char const *const filename = "out/tmp/test_bitstream_sink.bin";
+	bitstream* memory = bitstream_construct();
+	bitstream* sink = bitstream_construct_to_file(filename);
+	bitstream_write_value(memory, 0, 3);
+	bitstream_write_value(sink, 0, 3);
+	bitstream_write_value(memory, 0, 20);
+	bitstream_write_value(sink, 0, 20);
+	for (int i = 0; i < 100000; i++) {
+		bitstream_write_value(memory, i, 7);
+		bitstream_write_value(sink, i, 7);
+	}
+	if (sink -> allocated > 2 * 10240 + 8) {
+		printf("sink memory grew with the output size\n");
+		ret = 1;
+	}
+	if (sink -> flushed == 0) {
+		printf("sink didn't write anything before being destructed\n");
+		ret = 1;
+	}
+	bitstream_patch_value(memory, 3, 0xabcde, 20);
+	bitstream_patch_value(sink, 3, 0xabcde, 20);
+	bitstream_patch_value(memory, bitstream_bit_size(memory) - 10, 0x155, 10);
+	bitstream_patch_value(sink, bitstream_bit_size(sink) - 10, 0x155, 10);
+	if (bitstream_bit_size(sink) != bitstream_bit_size(memory)) {
+		printf("sink and memory bitstreams have different sizes\n");
+		ret = 1;
+	}
+	bitstream_destruct(sink);
+
+	bitstream* written = bitstream_construct_from_file(filename);
+	if (bitstream_byte_size(written) != bitstream_byte_size(memory)
+			|| memcmp(bitstream_byte_array(written), bitstream_byte_array(memory), bitstream_byte_size(memory))) {
+		printf("sink output doesn't match memory bitstream\n");
+		ret = 1;
+	}
+	bitstream_destruct(written);
+	bitstream_destruct(memory);
+	remove(filename);
+	return ret;
+}
+
+static int test_code_bits(char const *const name, bitstream *const bs, char const *const expected) {
+	size_t const length = strlen(expected);
+	if (bitstream_bit_size(bs) != length) {
+		printf("%s code has %zu bits instead of %zu\n", name, bitstream_bit_size(bs), length);
+		return 1;
+	}
+	for (size_t i = 0; i < length; i++) {
+		int const bit = (bitstream_byte_array(bs)[i / 8] >> (7 - i % 8)) & 1;
+		if (bit != expected[i] - '0') {
+			printf("%s code bit %zu is wrong\n", name, i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int test_codes() {
+	int ret = 0;
+	bitstream* bs;
+
+	bs = bitstream_construct();
+	bitstream_write_unary(bs, 3);
+	bitstream_write_truncated(bs, 4, 5);
+	ret |= test_code_bits("unary/truncated", bs, "1110111");
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct();
+	bitstream_write_gamma(bs, 5);
+	bitstream_write_delta(bs, 10);
+	ret |= test_code_bits("gamma/delta", bs, "00101" "00100010");
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct();
+	bitstream_write_omega(bs, 17);
+	bitstream_write_even_rodeh(bs, 8);
+	ret |= test_code_bits("omega/even-rodeh", bs, "10100100010" "10010000");
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct();
+	bitstream_write_golomb(bs, 42, 10);
+	bitstream_write_rice(bs, 9, 2);
+	bitstream_write_fibonacci(bs, 11);
+	ret |= test_code_bits("golomb/rice/fibonacci", bs, "11110010" "11001" "001011");
+	bitstream_destruct(bs);
+
+	bs = bitstream_construct();
+	test_random_state = 3;
+	for (int i = 0; i < 2000; i++) {
+		long const value = 1 + (long)(test_random() >> (test_random() % 62));
+		bitstream_write_gamma(bs, value);
+		bitstream_write_delta(bs, value);
+		bitstream_write_omega(bs, value);
+		bitstream_write_even_rodeh(bs, value);
+		bitstream_write_fibonacci(bs, value);
+		bitstream_write_truncated(bs, value % 1000, 1000);
+		bitstream_write_golomb(bs, value % 5000, 37);
+		bitstream_write_rice(bs, value % 5000, 5);
+		bitstream_write_unary(bs, value % 200);
+	}
+	bs -> current = 0;
+	test_random_state = 3;
+	for (int i = 0; i < 2000 && !ret; i++) {
+		long const value = 1 + (long)(test_random() >> (test_random() % 62));
+		if (bitstream_read_gamma(bs) != value
+				|| bitstream_read_delta(bs) != value
+				|| bitstream_read_omega(bs) != value
+				|| bitstream_read_even_rodeh(bs) != value
+				|| bitstream_read_fibonacci(bs) != value
+				|| bitstream_read_truncated(bs, 1000) != value % 1000
+				|| bitstream_read_golomb(bs, 37) != value % 5000
+				|| bitstream_read_rice(bs, 5) != value % 5000
+				|| bitstream_read_unary(bs) != value % 200) {
+			printf("integer code round trip %d failed for %ld\n", i, value);
+			ret = 1;
+		}
+	}
+	if (!ret && bitstream_read_gamma(bs) != -1) {
+		printf("reading an integer code past the end doesn't return -1\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+
+	test_random_state = 5;
+	for (int i = 0; i < 2000 && !ret; i++) {
+		long const value = 1 + (long)(test_random() >> (test_random() % 62));
+		long const range = 1 + value % 1000;
+		bs = bitstream_construct();
+		bitstream_write_gamma(bs, value);
+		size_t const gamma = bitstream_bit_size(bs);
+		bitstream_write_truncated(bs, value % range, range);
+		if (bitstream_gamma_bits(value) != gamma
+				|| bitstream_truncated_bits(value % range, range) != bitstream_bit_size(bs) - gamma) {
+			printf("integer code size %d doesn't match bits written for %ld\n", i, value);
+			ret = 1;
+		}
+		if (bitstream_unzigzag(bitstream_zigzag(value)) != value
+				|| bitstream_unzigzag(bitstream_zigzag(-value)) != -value
+				|| bitstream_zigzag(-value) != 2 * value - 1) {
+			printf("zigzag round trip %d failed for %ld\n", i, value);
+			ret = 1;
+		}
+		bitstream_destruct(bs);
+	}
+	return ret;
+}
+
+int test_peek() {
+	int ret = 0;
+	bitstream* bs = bitstream_construct();
+	bitstream_write_value(bs, 0xfff, 12);
+	bitstream_write_value(bs, 0x5a5, 12);
+	bitstream_write_value(bs, 0x7, 3);
+	bs -> current = 0;
+	if (bitstream_remaining(bs) != 27) {
+		printf("remaining bits at start isn't 27\n");
+		ret = 1;
+	}
+	if (bitstream_peek(bs, 24) != 0xfff5a5 || bs -> current != 0) {
+		printf("peek doesn't return the next bits\n");
+		ret = 1;
+	}
+	bitstream_skip(bs, 12);
+	if (bitstream_peek(bs, 12) != 0x5a5 || bitstream_remaining(bs) != 15) {
+		printf("peek after skip doesn't return the next bits\n");
+		ret = 1;
+	}
+	bitstream_skip(bs, 12);
+	if (bitstream_peek(bs, 8) != 0xe0) {
+		printf("peek past the end isn't zero-padded\n");
+		ret = 1;
+	}
+	bitstream_skip(bs, 100);
+	if (bitstream_remaining(bs) != 0 || bitstream_peek(bs, 57) != 0) {
+		printf("skip past the end doesn't stop at the end\n");
+		ret = 1;
+	}
+	bitstream_destruct(bs);
+	return ret;
+}
+
+int test_bytes() {
+	int ret = 0;
+	unsigned char data[30000];
+	unsigned char readback[30000];
+	test_random_state = 4;
+	for (size_t i = 0; i < sizeof data; i++) {
+		data[i] = (unsigned char)test_random();
+	}
+	for (int offset = 0; offset < 8; offset++) {
+		bitstream* bytes = bitstream_construct();
+		bitstream* values = bitstream_construct();
+		bitstream_write_value(bytes, 0x55, offset);
+		bitstream_write_value(values, 0x55, offset);
+		bitstream_write_bytes(bytes, data, sizeof data);
+		for (size_t i = 0; i < sizeof data; i++) {
+			bitstream_write_value(values, data[i], 8);
+		}
+		bitstream_write_value(bytes, 0x3, 2);
+		bitstream_write_value(values, 0x3, 2);
+		if (bitstream_bit_size(bytes) != bitstream_bit_size(values)
+				|| memcmp(bitstream_byte_array(bytes), bitstream_byte_array(values), bitstream_byte_size(values))) {
+			printf("byte write at bit offset %d doesn't match value writes\n", offset);
+			ret = 1;
+		}
+		bytes -> current = offset;
+		if (bitstream_read_bytes(bytes, readback, sizeof readback) != sizeof readback
+				|| memcmp(readback, data, sizeof data)) {
+			printf("byte read at bit offset %d doesn't match what was written\n", offset);
+			ret = 1;
+		}
+		if (bitstream_read_bytes(bytes, readback, 1) != 0) {
+			printf("byte read past the end at bit offset %d returns data\n", offset);
+			ret = 1;
+		}
+		bitstream_destruct(bytes);
+		bitstream_destruct(values);
+	}
+	return ret;
+}
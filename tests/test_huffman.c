@@ -0,0 +1,354 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "../bitstream_internal.h"
+#include "../huffman_internal.h"
+#include "../symbol_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int test_decoder();
+int test_encoder();
+int test_import_stats();
+int test_multi();
+int test_tuples();
+int test_tree_formats();
+
+int main(int, char**) {
+	int ret = 0;
+	ret |= test_decoder();
+	ret |= test_encoder();
+	ret |= test_import_stats();
+	ret |= test_multi();
+	ret |= test_tuples();
+	ret |= test_tree_formats();
+	return ret;
+}
+
+static unsigned long test_random_state = 1;
+
+static unsigned long test_random() {
+	test_random_state = test_random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return test_random_state >> 16;
+}
+
+/* Value written after the encoded symbols, to check that decoders stop at the right bit */
+static long const test_trailer = 0x5a5;
+static int const test_trailer_bits = 12;
+
+/*
+ * Skewed random symbols. Kind 0 stays in a narrow range, kind 1 spreads
+ * over a wider range, kind 2 repeats a single value and kind 3 uses a
+ * few values far apart, which makes the symbol slots sparse.
+ */
+static long* test_symbols(long const count, int const kind) {
+	long *const symbols = malloc(count * sizeof(long));
+	long const offset = (long)(test_random() % 200) - 100;
+	long const range = kind == 0 ? 1 + test_random() % 40 : 1 + test_random() % 2000;
+	for (long i = 0; i < count; i++) {
+		long const r = test_random() % range;
+		switch (kind) {
+			case 0:
+			case 1:
+				symbols[i] = offset + (test_random() % 4 ? r * r / range : r);
+				break;
+			case 2:
+				symbols[i] = offset;
+				break;
+			default:
+				symbols[i] = (long)(test_random() % 3) * 1000003 - 500000;
+				break;
+		}
+	}
+	return symbols;
+}
+
+static huffman* test_count(long const *const symbols, long const count) {
+	huffman *const h = huffman_construct();
+	huffman_compute_symbol_range(h, symbols, count);
+	huffman_compute_symbol_counts(h, symbols, count);
+	huffman_count_symbols_present(h);
+	return h;
+}
+
+/* Write the tree and encode the symbols, then decode and compare */
+static int test_encode_decode(char const *const name,
+			huffman *const h,
+			long const *const symbols,
+			long const count) {
+	int ret = 0;
+	huffman_build_tree(h);
+	huffman_build_codes(h);
+	bitstream* bs = bitstream_construct();
+	huffman_write_tree(h, bs);
+	size_t const tree_bits = bitstream_bit_size(bs);
+	huffman_encode(h, symbols, count, bs);
+	if (bitstream_bit_size(bs) != huffman_cost_bits(h)) {
+		printf("%s: cost %zu bits, wrote %zu\n", name, huffman_cost_bits(h), bitstream_bit_size(bs));
+		ret = 1;
+	}
+	bitstream_write_value(bs, test_trailer, test_trailer_bits);
+	bs -> current = 0;
+	long *const decoded = malloc(count * sizeof(long));
+	huffmandecoder* decoder = huffmandecoder_construct();
+	huffmandecoder_read_tree(decoder, bs);
+	if (bs -> current != tree_bits) {
+		printf("%s: tree read in %zu bits, written in %zu\n", name, bs -> current, tree_bits);
+		ret = 1;
+	}
+	huffmandecoder_decode(decoder, bs, decoded, count);
+	for (long i = 0; i < count && !ret; i++) {
+		if (decoded[i] != symbols[i]) {
+			printf("%s: symbol %ld decoded as %ld instead of %ld\n", name, i, decoded[i], symbols[i]);
+			ret = 1;
+		}
+	}
+	if (!ret && bitstream_read_value(bs, test_trailer_bits) != test_trailer) {
+		printf("%s: decoder didn't stop after the last symbol\n", name);
+		ret = 1;
+	}
+	free(decoded);
+	huffmandecoder_destruct(decoder);
+	bitstream_destruct(bs);
+	return ret;
+}
+
+/* Codes longer than the primary table go through secondary tables */
+int test_decoder() {
+	int ret = 0;
+	test_random_state = 1;
+	for (int i = 0; i < 60 && !ret; i++) {
+		long const count = 1 + test_random() % 5000;
+		long *const symbols = test_symbols(count, i % 4);
+		for (int tiebreak = HUFFMAN_TIES_LEAVES_FIRST; tiebreak <= HUFFMAN_TIES_MERGED_FIRST; tiebreak++) {
+			huffman *const h = test_count(symbols, count);
+			huffman_set_tiebreak(h, tiebreak);
+			if (i % 4 == 3 && !h -> values) {
+				printf("far apart symbols don't use sparse slots\n");
+				ret = 1;
+			}
+			ret |= test_encode_decode("decoder", h, symbols, count);
+			huffman_destruct(h);
+		}
+		free(symbols);
+	}
+
+	test_random_state = 2;
+	long const count = 100000;
+	long *const symbols = malloc(count * sizeof(long));
+	// Geometric distribution, whose unlimited codes get as long as the range
+	for (long i = 0; i < count; i++) {
+		symbols[i] = __builtin_ctzl(test_random() | (1UL << 40));
+	}
+	for (long max_bits = 0; max_bits <= 16 && !ret; max_bits += max_bits ? 2 : 6) {
+		huffman *const h = test_count(symbols, count);
+		huffman_set_max_bits(h, max_bits);
+		ret |= test_encode_decode("long codes", h, symbols, count);
+		for (long slot = 0; max_bits && slot < h -> slots; slot++) {
+			if (h -> symbols[slot].count && h -> symbols[slot].bits > max_bits) {
+				printf("code of %ld bits over the limit of %ld\n", h -> symbols[slot].bits, max_bits);
+				ret = 1;
+			}
+		}
+		huffman_destruct(h);
+	}
+	free(symbols);
+	return ret;
+}
+
+/* The bulk encoder writes the same bits as one code at a time */
+int test_encoder() {
+	int ret = 0;
+	test_random_state = 3;
+	for (int i = 0; i < 30 && !ret; i++) {
+		long const count = 1 + test_random() % 5000;
+		long *const symbols = test_symbols(count, i % 4);
+		huffman *const h = test_count(symbols, count);
+		huffman_build_tree(h);
+		huffman_build_codes(h);
+		bitstream* bulk = bitstream_construct();
+		bitstream* single = bitstream_construct();
+		huffman_encode(h, symbols, count, bulk);
+		for (long j = 0; j < count; j++) {
+			hsymbol const *const symbol = h -> symbols + huffman_slot(h, symbols[j]);
+			bitstream_write_value(single, symbol -> code, symbol -> bits);
+		}
+		if (bitstream_bit_size(bulk) != bitstream_bit_size(single)
+				|| memcmp(bitstream_byte_array(bulk), bitstream_byte_array(single), bitstream_byte_size(single))) {
+			printf("bulk encoding of %ld symbols differs from single codes\n", count);
+			ret = 1;
+		}
+		bitstream_destruct(bulk);
+		bitstream_destruct(single);
+		huffman_destruct(h);
+		free(symbols);
+	}
+	return ret;
+}
+
+/* Imported statistics give the same tree and codes as counting directly */
+int test_import_stats() {
+	int ret = 0;
+	test_random_state = 4;
+	for (int i = 0; i < 16 && !ret; i++) {
+		long const count = 1 + test_random() % 5000;
+		long *const symbols = test_symbols(count, i % 4);
+		symbol_stats *const stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+		huffman *const counted = test_count(symbols, count);
+		huffman *const imported = huffman_construct();
+		huffman_import_stats(imported, stats);
+		bitstream* counted_bits = bitstream_construct();
+		bitstream* imported_bits = bitstream_construct();
+		huffman* const processors[] = { counted, imported };
+		bitstream* const streams[] = { counted_bits, imported_bits };
+		for (int p = 0; p < 2; p++) {
+			huffman_build_tree(processors[p]);
+			huffman_build_codes(processors[p]);
+			huffman_write_tree(processors[p], streams[p]);
+			huffman_encode(processors[p], symbols, count, streams[p]);
+		}
+		if (bitstream_bit_size(counted_bits) != bitstream_bit_size(imported_bits)
+				|| memcmp(bitstream_byte_array(counted_bits),
+							bitstream_byte_array(imported_bits),
+							bitstream_byte_size(counted_bits))) {
+			printf("imported statistics encode %ld symbols differently\n", count);
+			ret = 1;
+		}
+		bitstream_destruct(counted_bits);
+		bitstream_destruct(imported_bits);
+		huffman_destruct(counted);
+		huffman_destruct(imported);
+		symbol_stats_destruct(stats);
+		free(symbols);
+	}
+	return ret;
+}
+
+
+/* Round trip through one of the whole-buffer coders, with a trailer */
+static int test_coder(char const *const name,
+			long const *const symbols,
+			long const count,
+			void (*const encode)(long const *const, long const, bitstream *const, void const *const),
+			void (*const decode)(bitstream *const, long *const, long const),
+			void const *const parameters) {
+	int ret = 0;
+	bitstream* bs = bitstream_construct();
+	encode(symbols, count, bs, parameters);
+	bitstream_write_value(bs, test_trailer, test_trailer_bits);
+	bs -> current = 0;
+	long *const decoded = malloc(count * sizeof(long));
+	decode(bs, decoded, count);
+	for (long i = 0; i < count && !ret; i++) {
+		if (decoded[i] != symbols[i]) {
+			printf("%s: symbol %ld decoded as %ld instead of %ld\n", name, i, decoded[i], symbols[i]);
+			ret = 1;
+		}
+	}
+	if (!ret && bitstream_read_value(bs, test_trailer_bits) != test_trailer) {
+		printf("%s: decoder didn't stop after the last symbol\n", name);
+		ret = 1;
+	}
+	free(decoded);
+	bitstream_destruct(bs);
+	return ret;
+}
+
+/* Parameters are the block size, the most tables and whether to pass statistics */
+static void test_encode_multi(long const *const symbols, long const count, bitstream *const bs, void const *const parameters) {
+	long const *const blocks_tables = parameters;
+	symbol_stats* stats = NULL;
+	if (blocks_tables[2]) {
+		stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+	}
+	huffman_encode_multi(symbols, count, stats, blocks_tables[0], blocks_tables[1], bs);
+	symbol_stats_destruct(stats);
+}
+
+int test_multi() {
+	int ret = 0;
+	test_random_state = 5;
+	for (int i = 0; i < 24 && !ret; i++) {
+		long const count = 1 + test_random() % 20000;
+		long *const symbols = test_symbols(count, i % 4);
+		// Switch statistics halfway, so that several tables pay off
+		for (long j = count / 2; j < count; j++) {
+			symbols[j] = symbols[j] * 3 + 7;
+		}
+		long const blocks_tables[3] = { 1 + test_random() % 200, 1 + i % 6, i % 2 };
+		ret |= test_coder("multi-table", symbols, count, test_encode_multi, huffman_decode_multi, blocks_tables);
+		free(symbols);
+	}
+	return ret;
+}
+
+/* Parameter is whether to pass statistics */
+static void test_encode_tuples(long const *const symbols, long const count, bitstream *const bs, void const *const parameters) {
+	long const *const with_stats = parameters;
+	symbol_stats* stats = NULL;
+	if (*with_stats) {
+		stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+	}
+	huffman_encode_tuples(symbols, count, stats, bs);
+	symbol_stats_destruct(stats);
+}
+
+int test_tuples() {
+	int ret = 0;
+	test_random_state = 6;
+	for (int i = 0; i < 24 && !ret; i++) {
+		long const count = 1 + test_random() % 20000;
+		long const range = 1 + test_random() % 6;
+		long *const symbols = malloc(count * sizeof(long));
+		for (long j = 0; j < count; j++) {
+			symbols[j] = (long)(test_random() % range) - 2;
+		}
+		long const with_stats = i % 2;
+		ret |= test_coder("tuples", symbols, count, test_encode_tuples, huffman_decode_tuples, &with_stats);
+		free(symbols);
+	}
+	return ret;
+}
+
+/* Every tree format reads back exactly the bits it wrote */
+int test_tree_formats() {
+	static char const *const names[] = { "nodes", "leaves", "lengths", "bitmap", "auto" };
+	int ret = 0;
+	test_random_state = 7;
+	for (int i = 0; i < 40 && !ret; i++) {
+		long const count = 1 + test_random() % 5000;
+		long *const symbols = test_symbols(count, i % 4);
+		for (int format = HUFFMAN_TREE_NODES; format <= HUFFMAN_TREE_AUTO; format++) {
+			for (int tiebreak = HUFFMAN_TIES_LEAVES_FIRST; tiebreak <= HUFFMAN_TIES_MERGED_FIRST; tiebreak++) {
+				huffman *const h = test_count(symbols, count);
+				huffman_set_tree_format(h, format);
+				huffman_set_tiebreak(h, tiebreak);
+				ret |= test_encode_decode(names[format], h, symbols, count);
+				huffman_destruct(h);
+			}
+		}
+		free(symbols);
+	}
+	return ret;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "../bitstream_internal.h"
+#include "../lz78_internal.h"
+#include "../symbol_stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int test_round_trip();
+int test_bounded();
+int test_import_stats();
+
+int main(int, char**) {
+	int ret = 0;
+	ret |= test_round_trip();
+	ret |= test_bounded();
+	ret |= test_import_stats();
+	return ret;
+}
+
+static unsigned long test_random_state = 1;
+
+static unsigned long test_random() {
+	test_random_state = test_random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return test_random_state >> 16;
+}
+
+/* Random symbols in a range, repeating earlier stretches so that matches get long */
+static long* test_symbols(long const count, long const range, long const offset) {
+	long *const symbols = malloc(count * sizeof(long));
+	for (long i = 0; i < count; i++) {
+		if (i > 16 && test_random() % 4) {
+			symbols[i] = symbols[i - 1 - test_random() % 16];
+		} else {
+			symbols[i] = offset + (long)(test_random() % range);
+		}
+	}
+	return symbols;
+}
+
+/* Encode, check the cost against the bits written, decode and compare */
+static int test_encode_decode(char const *const name,
+			long const *const symbols,
+			long const count,
+			long const max_entries,
+			enum lz78_policy const policy) {
+	int ret = 0;
+	lz78encoder* encoder = lz78encoder_construct();
+	lz78encoder_set_max_entries(encoder, max_entries, policy);
+	lz78encoder_compute_symbol_range(encoder, symbols, count);
+	lz78encoder_find_matches(encoder, symbols, count);
+	if (max_entries && encoder -> trie.nodes > max_entries + 1) {
+		printf("%s: dictionary grew to %ld nodes\n", name, encoder -> trie.nodes);
+		ret = 1;
+	}
+	bitstream* bs = bitstream_construct();
+	lz78encoder_write(encoder, bs);
+	if (bitstream_bit_size(bs) != lz78encoder_cost_bits(encoder)) {
+		printf("%s: cost %zu bits, wrote %zu\n", name, lz78encoder_cost_bits(encoder), bitstream_bit_size(bs));
+		ret = 1;
+	}
+	bs -> current = 0;
+	long decoded_count;
+	long *const decoded = lz78_decode(bs, &decoded_count);
+	if (decoded_count != count) {
+		printf("%s: decoded %ld symbols instead of %ld\n", name, decoded_count, count);
+		ret = 1;
+	}
+	for (long i = 0; i < count && !ret; i++) {
+		if (decoded[i] != symbols[i]) {
+			printf("%s: symbol %ld decoded as %ld instead of %ld\n", name, i, decoded[i], symbols[i]);
+			ret = 1;
+		}
+	}
+	if (!ret && bs -> current != bitstream_bit_size(bs)) {
+		printf("%s: decoder stopped at bit %zu of %zu\n", name, bs -> current, bitstream_bit_size(bs));
+		ret = 1;
+	}
+	free(decoded);
+	bitstream_destruct(bs);
+	lz78encoder_destruct(encoder);
+	return ret;
+}
+
+int test_round_trip() {
+	int ret = 0;
+	long const one = 42;
+	ret |= test_encode_decode("single symbol", &one, 1, 0, LZ78_FULL_STOP);
+
+	test_random_state = 1;
+	for (int i = 0; i < 100 && !ret; i++) {
+		long const count = 1 + test_random() % 20000;
+		// Alternate between dense and hashed trie children
+		long const range = 1 + test_random() % (i % 2 ? 16 : 100000);
+		long const offset = (long)(test_random() % 100) - 50;
+		long *const symbols = test_symbols(count, range, offset);
+		ret |= test_encode_decode("unbounded", symbols, count, 0, LZ78_FULL_STOP);
+		free(symbols);
+	}
+	return ret;
+}
+
+int test_bounded() {
+	static char const *const names[] = {
+		"stop", "clear", "evict LRU", "evict leaf", "evict leaves"
+	};
+	static long const bounds[] = { 1, 2, 7, 300, 4000 };
+	int ret = 0;
+	test_random_state = 2;
+	for (int policy = LZ78_FULL_STOP; policy <= LZ78_FULL_EVICT_LEAVES; policy++) {
+		for (int b = 0; b < (int)(sizeof bounds / sizeof bounds[0]); b++) {
+			for (int i = 0; i < 4 && !ret; i++) {
+				long const count = 1 + test_random() % 20000;
+				long const range = 1 + test_random() % (i % 2 ? 16 : 100000);
+				long *const symbols = test_symbols(count, range, 0);
+				ret |= test_encode_decode(names[policy], symbols, count, bounds[b], policy);
+				free(symbols);
+			}
+		}
+	}
+	return ret;
+}
+
+/* Imported statistics give the same stream as computing the range directly */
+int test_import_stats() {
+	int ret = 0;
+	test_random_state = 3;
+	for (int i = 0; i < 20 && !ret; i++) {
+		long const count = 1 + test_random() % 20000;
+		long const range = 1 + test_random() % (i % 2 ? 16 : 100000);
+		long const offset = (long)(test_random() % 100) - 50;
+		long *const symbols = test_symbols(count, range, offset);
+		symbol_stats *const stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+		lz78encoder* computed = lz78encoder_construct();
+		lz78encoder* imported = lz78encoder_construct();
+		lz78encoder_compute_symbol_range(computed, symbols, count);
+		lz78encoder_import_stats(imported, stats);
+		bitstream* computed_bits = bitstream_construct();
+		bitstream* imported_bits = bitstream_construct();
+		lz78encoder* const encoders[] = { computed, imported };
+		bitstream* const streams[] = { computed_bits, imported_bits };
+		for (int e = 0; e < 2; e++) {
+			lz78encoder_find_matches(encoders[e], symbols, count);
+			lz78encoder_write(encoders[e], streams[e]);
+		}
+		if (bitstream_bit_size(computed_bits) != bitstream_bit_size(imported_bits)
+				|| memcmp(bitstream_byte_array(computed_bits),
+							bitstream_byte_array(imported_bits),
+							bitstream_byte_size(computed_bits))) {
+			printf("imported statistics encode %ld symbols differently\n", count);
+			ret = 1;
+		}
+		bitstream_destruct(computed_bits);
+		bitstream_destruct(imported_bits);
+		lz78encoder_destruct(computed);
+		lz78encoder_destruct(imported);
+		symbol_stats_destruct(stats);
+		free(symbols);
+	}
+	return ret;
+}
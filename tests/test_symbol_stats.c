@@ -0,0 +1,163 @@
+/*
+ * Copyright 2025 Jean-Baptiste M. "JBQ" "Djaybee" Queru
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SPDX-License-Identifier: AGPL-3.0-or-later
+
+#include "../symbol_stats.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int test_known();
+int test_random_buffers();
+
+int main(int, char**) {
+	int ret = 0;
+	ret |= test_known();
+	ret |= test_random_buffers();
+	return ret;
+}
+
+static unsigned long test_random_state = 1;
+
+static unsigned long test_random() {
+	test_random_state = test_random_state * 6364136223846793005UL + 1442695040888963407UL;
+	return test_random_state >> 16;
+}
+
+static int test_close(double const a, double const b) {
+	return fabs(a - b) <= 1e-6 * (1 + fabs(b));
+}
+
+/* Runs of 3, 1, 8 and 1 symbols, with 4 distinct values */
+int test_known() {
+	static long const symbols[] = { 5, 5, 5, -2, 7, 7, 7, 7, 7, 7, 7, 7, 5 };
+	long const count = sizeof symbols / sizeof symbols[0];
+	int ret = 0;
+	symbol_stats *const stats = symbol_stats_construct();
+	symbol_stats_compute(stats, symbols, count);
+	if (symbol_stats_min(stats) != -2 || symbol_stats_max(stats) != 7 || symbol_stats_distinct(stats) != 3) {
+		printf("known buffer has range %ld-%ld with %ld distinct values\n",
+					symbol_stats_min(stats),
+					symbol_stats_max(stats),
+					symbol_stats_distinct(stats));
+		ret = 1;
+	}
+	if (symbol_stats_count(stats, 5) != 4 || symbol_stats_count(stats, 7) != 8
+				|| symbol_stats_count(stats, 0) != 0 || symbol_stats_count(stats, 100) != 0) {
+		printf("known buffer has wrong counts\n");
+		ret = 1;
+	}
+	long const runs[] = { 2, 1, 0, 1, 0 };
+	for (int bucket = 0; bucket < 5; bucket++) {
+		if (symbol_stats_runs(stats, bucket) != runs[bucket]) {
+			printf("known buffer has %ld runs in bucket %d instead of %ld\n",
+						symbol_stats_runs(stats, bucket),
+						bucket,
+						runs[bucket]);
+			ret = 1;
+		}
+	}
+	double const entropy = 4 * log2(13. / 4) + 8 * log2(13. / 8) + log2(13.);
+	if (!test_close(symbol_stats_entropy_bits(stats), entropy)) {
+		printf("known buffer has entropy %f instead of %f\n", symbol_stats_entropy_bits(stats), entropy);
+		ret = 1;
+	}
+	symbol_stats_destruct(stats);
+
+	long const same[] = { 9, 9, 9, 9 };
+	symbol_stats *const repeated = symbol_stats_construct();
+	symbol_stats_compute(repeated, same, 4);
+	if (symbol_stats_entropy_bits(repeated) != 0 || symbol_stats_runs(repeated, 2) != 1) {
+		printf("repeated symbol has entropy %f\n", symbol_stats_entropy_bits(repeated));
+		ret = 1;
+	}
+	symbol_stats_destruct(repeated);
+	return ret;
+}
+
+/* Compare against counts, runs and entropy computed naively */
+int test_random_buffers() {
+	int ret = 0;
+	test_random_state = 1;
+	for (int i = 0; i < 40 && !ret; i++) {
+		long const count = 1 + test_random() % 20000;
+		// Narrow ranges are counted densely, far apart values sparsely
+		long const range = i % 2 ? 1 + test_random() % 300 : 20;
+		long const spacing = i % 2 ? 1 : 100003;
+		long *const symbols = malloc(count * sizeof(long));
+		for (long j = 0; j < count; j++) {
+			symbols[j] = j && test_random() % 3 ? symbols[j - 1] : ((long)(test_random() % range) - 5) * spacing;
+		}
+		symbol_stats *const stats = symbol_stats_construct();
+		symbol_stats_compute(stats, symbols, count);
+
+		long runs[64] = { 0 };
+		long run = 1;
+		for (long j = 0; j < count; j++) {
+			if (j + 1 < count && symbols[j + 1] == symbols[j]) {
+				run++;
+			} else {
+				runs[63 - __builtin_clzl(run)]++;
+				run = 1;
+			}
+		}
+		for (int bucket = 0; bucket < 64; bucket++) {
+			if (symbol_stats_runs(stats, bucket) != runs[bucket]) {
+				printf("buffer %d has %ld runs in bucket %d instead of %ld\n",
+							i,
+							symbol_stats_runs(stats, bucket),
+							bucket,
+							runs[bucket]);
+				ret = 1;
+			}
+		}
+
+		long distinct = 0;
+		double entropy = 0;
+		for (long value = -5; value < range - 5; value++) {
+			long instances = 0;
+			for (long j = 0; j < count; j++) {
+				instances += symbols[j] == value * spacing;
+			}
+			if (symbol_stats_count(stats, value * spacing) != instances) {
+				printf("buffer %d has %ld instances of %ld instead of %ld\n",
+							i,
+							symbol_stats_count(stats, value * spacing),
+							value * spacing,
+							instances);
+				ret = 1;
+			}
+			if (instances) {
+				distinct++;
+				entropy += instances * log2((double)count / instances);
+			}
+		}
+		if (symbol_stats_distinct(stats) != distinct) {
+			printf("buffer %d has %ld distinct values instead of %ld\n", i, symbol_stats_distinct(stats), distinct);
+			ret = 1;
+		}
+		if (!test_close(symbol_stats_entropy_bits(stats), entropy)) {
+			printf("buffer %d has entropy %f instead of %f\n", i, symbol_stats_entropy_bits(stats), entropy);
+			ret = 1;
+		}
+		symbol_stats_destruct(stats);
+		free(symbols);
+	}
+	return ret;
+}